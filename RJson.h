@@ -14,14 +14,1251 @@
 #ifndef __RJson_H__
 #define __RJson_H__
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+#include "rapidjson/memorystream.h"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
 
 namespace RJson {
+class RSchema;
+class RSnapshot;
+template<unsigned> class GenericRPushParser;
+
+/// RDocument::fromJson()解析选项，可按位组合
+enum RParseFlag {
+    kParseDefault = rapidjson::kParseDefaultFlags,
+    /// 按完整精度解析浮点数，速度较慢
+    kParseFullPrecision = rapidjson::kParseFullPrecisionFlag,
+    /// 允许NaN、Inf、Infinity、-Inf、-Infinity
+    kParseNanAndInf = rapidjson::kParseNanAndInfFlag,
+    /// 允许/**/和//注释
+    kParseComments = rapidjson::kParseCommentsFlag,
+    /// 允许对象和数组末尾多余的逗号
+    kParseTrailingCommas = rapidjson::kParseTrailingCommasFlag,
+    /// 数字保存原始文本，首次toInt()/toDouble()等访问时才解码，toJson()时原样输出
+    kParseLazyNumbers = 1 << 16,
+    /// 开启文档的key共享，相同的key只保存一份，见RDocument::setKeyInterning()
+    kParseInternKeys = 1 << 17,
+    /// 元素全部为同类数字的数组(根节点除外)以紧凑数组保存，见RPackedType
+    kParsePackArrays = 1 << 18
+};
+
+/**
+ * @brief 紧凑数组的元素类型。
+ * 紧凑数组把同类数字连续保存，每个元素只占4或8字节，可以通过span()直接访问，序列化时展开为普通数组。
+ * 追加类型不同的元素、按下标取得可修改的RValue或者删除元素时自动转换为普通数组。
+ */
+enum RPackedType {
+    kPackedNone = 0,
+    kPackedInt32 = 1,
+    kPackedInt64 = 2,
+    kPackedDouble = 3
+};
+
+namespace detail {
+/// 延迟解码的数字以字符串形式保存，首字节为kRawNumberTag，其后为原始数字文本。
+/// 0xFF不是合法的UTF-8字节，外部写入的字符串以它开头时一律拒绝(见isReservedString)，标记因此只能由解析器生成。
+const char kRawNumberTag = '\xFF';
+/// 紧凑数组的首字节，见packedType()。0xFE同样不是合法的UTF-8字节
+const char kPackedTag = '\xFE';
+
+/// 首字节是内部标记的字符串，解析、setValue()等写入外部字符串的接口遇到时拒绝，防止伪造内部表示
+inline bool isReservedString(const char *str, size_t length) {
+    return length > 0 && (str[0] == kRawNumberTag || str[0] == kPackedTag);
+}
+
+/// 写入外部字符串，首字节是内部标记时拒绝并返回false，value不变
+template<typename Allocator>
+bool setString(rapidjson::Value &value, const char *str, size_t length, Allocator &allocator) {
+    if (isReservedString(str, length)) return false;
+    value.SetString(str, static_cast<rapidjson::SizeType>(length), allocator);
+    return true;
+}
+
+inline bool isRawNumber(const char *str, rapidjson::SizeType length) {
+    return length > 1 && str[0] == kRawNumberTag;
+}
+
+inline bool isRawNumber(const rapidjson::Value &value) {
+    return value.IsString() && isRawNumber(value.GetString(), value.GetStringLength());
+}
+
+/// 只接受单个数字的SAX Handler
+struct NumberHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, NumberHandler> {
+    explicit NumberHandler(rapidjson::Value &v) : value(v) {}
+    bool Default() { return false; }
+    bool Int(int i) { value.SetInt(i); return true; }
+    bool Uint(unsigned u) { value.SetUint(u); return true; }
+    bool Int64(int64_t i) { value.SetInt64(i); return true; }
+    bool Uint64(uint64_t u) { value.SetUint64(u); return true; }
+    bool Double(double d) { value.SetDouble(d); return true; }
+    rapidjson::Value &value;
+};
+
+/// 常见数字的快速解码：不超过18位的整数，以及有效数字不超过15位、10的指数绝对值不超过22的小数。
+/// 尾数和10的幂都能被double精确表示，一次乘除即得到正确舍入的结果，与完整精度解析一致；
+/// 不用strtod是为了不受locale小数点的影响。不属于这两类时返回false
+inline bool decodeSimpleNumber(const char *str, size_t length, rapidjson::Value &out) {
+    static const double kPow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char *p = str, *end = str + length;
+    const bool minus = p < end && *p == '-';
+    if (minus) ++p;
+    if (p == end || *p < '0' || *p > '9') return false;
+    //JSON不允许前导0
+    if (*p == '0' && p + 1 < end && p[1] >= '0' && p[1] <= '9') return false;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+    if (p == end) {
+        if (digits > 18) return false;
+        const int64_t i = static_cast<int64_t>(mantissa);
+        out.SetInt64(minus ? -i : i);
+        return true;
+    }
+    int exponent = 0;
+    if (*p == '.') {
+        const char *fraction = ++p;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits, --exponent) mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+        if (p == fraction) return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const bool negative = ++p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) ++p;
+        const char *start = p;
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9' && e < 1000; ++p) e = e * 10 + (*p - '0');
+        if (p == start) return false;
+        exponent += negative ? -e : e;
+    }
+    if (p != end || digits > 15 || exponent < -22 || exponent > 22) return false;
+    double d = static_cast<double>(mantissa);
+    d = exponent < 0 ? d / kPow10[-exponent] : d * kPow10[exponent];
+    out.SetDouble(minus ? -d : d);
+    return true;
+}
+
+/// 把str开始的length字节数字文本解码到out中，文本不需要以'\0'结尾
+inline bool decodeNumber(const char *str, size_t length, rapidjson::Value &out) {
+    if (decodeSimpleNumber(str, length, out)) return true;
+    //长整数、高精度小数和NaN/Inf交给Reader，解析栈使用栈上缓冲区，避免每次解码都分配内存
+    char buffer[256];
+    rapidjson::MemoryPoolAllocator<> allocator(buffer, sizeof(buffer));
+    rapidjson::GenericReader<rapidjson::UTF8<>, rapidjson::UTF8<>, rapidjson::MemoryPoolAllocator<>> reader(&allocator, 64);
+    rapidjson::MemoryStream stream(str, length);
+    NumberHandler handler(out);
+    reader.Parse<rapidjson::kParseFullPrecisionFlag | rapidjson::kParseNanAndInfFlag>(stream, handler);
+    return !reader.HasParseError();
+}
+
+/// 返回可直接读取数值的值：普通值返回自身，延迟解码的数字解码到temp后返回temp
+inline const rapidjson::Value& number(const rapidjson::Value &value, rapidjson::Value &temp) {
+    if (!isRawNumber(value)) return value;
+    if (!decodeNumber(value.GetString() + 1, value.GetStringLength() - 1, temp)) temp.SetNull();
+    return temp;
+}
+
+/// 紧凑数组以字符串形式保存：首字节为kPackedTag，第2字节为元素类型，第5~8字节为元素个数，
+/// 之后从第8字节开始连续保存元素，字符串长度减去头部即为容量。分配器按8字节对齐分配，元素地址因此对齐。
+const size_t kPackedHeader = 8;
+/// 少于该个数的数组不压缩，同时保证字符串不会保存在Value内部
+const size_t kPackedMinCount = 4;
+
+template<typename T> struct PackedTypeOf { static const RPackedType value = kPackedNone; };
+template<> struct PackedTypeOf<int32_t> { static const RPackedType value = kPackedInt32; };
+template<> struct PackedTypeOf<int64_t> { static const RPackedType value = kPackedInt64; };
+template<> struct PackedTypeOf<double> { static const RPackedType value = kPackedDouble; };
+
+inline size_t packedElementSize(RPackedType type) { return type == kPackedInt32 ? sizeof(int32_t) : sizeof(int64_t); }
+
+inline uint32_t packedCount(const char *str) {
+    uint32_t count;
+    memcpy(&count, str + 4, sizeof(count));
+    return count;
+}
+
+/// 头部不完整或者元素个数超出字符串长度时不是紧凑数组，读取元素前都经过这里检查
+inline RPackedType packedType(const char *str, rapidjson::SizeType length) {
+    if (length < kPackedHeader || str[0] != kPackedTag) return kPackedNone;
+    auto type = static_cast<RPackedType>(str[1]);
+    if (type != kPackedInt32 && type != kPackedInt64 && type != kPackedDouble) return kPackedNone;
+    if (static_cast<uint64_t>(packedCount(str)) * packedElementSize(type) > length - kPackedHeader) return kPackedNone;
+    return type;
+}
+
+inline RPackedType packedType(const rapidjson::Value &value) {
+    return value.IsString() ? packedType(value.GetString(), value.GetStringLength()) : kPackedNone;
+}
+
+inline bool isPacked(const rapidjson::Value &value) { return packedType(value) != kPackedNone; }
+
+/// 普通字符串，不是延迟解码的数字或紧凑数组
+inline bool isPlainString(const rapidjson::Value &value) {
+    return value.IsString() && !isRawNumber(value) && !isPacked(value);
+}
+
+/// 生成紧凑数组的字符串内容，容量为capacity个元素，未使用部分填0
+inline void writePacked(std::string &buffer, RPackedType type, const void *data, size_t count, size_t capacity) {
+    const size_t size = packedElementSize(type);
+    buffer.assign(kPackedHeader + capacity * size, '\0');
+    buffer[0] = kPackedTag;
+    buffer[1] = static_cast<char>(type);
+    auto count32 = static_cast<uint32_t>(count);
+    memcpy(&buffer[4], &count32, sizeof(count32));
+    if (count > 0) memcpy(&buffer[kPackedHeader], data, count * size);
+}
+
+template<typename Allocator>
+void setPacked(rapidjson::Value &value, RPackedType type, const void *data, size_t count, size_t capacity, Allocator &allocator) {
+    std::string buffer;
+    writePacked(buffer, type, data, count, capacity);
+    value.SetString(buffer.data(), static_cast<rapidjson::SizeType>(buffer.size()), allocator);
+}
+
+/// 读取紧凑数组的第i个元素
+inline void packedElement(const char *str, RPackedType type, size_t i, rapidjson::Value &out) {
+    const char *data = str + kPackedHeader;
+    switch (type) {
+    case kPackedInt32: {
+        int32_t v;
+        memcpy(&v, data + i * sizeof(v), sizeof(v));
+        out.SetInt(v);
+        break;
+    }
+    case kPackedInt64: {
+        int64_t v;
+        memcpy(&v, data + i * sizeof(v), sizeof(v));
+        out.SetInt64(v);
+        break;
+    }
+    case kPackedDouble: {
+        double v;
+        memcpy(&v, data + i * sizeof(v), sizeof(v));
+        out.SetDouble(v);
+        break;
+    }
+    default:
+        out.SetNull();
+        break;
+    }
+}
+
+/// 紧凑数组转换为普通数组，其他值不变
+template<typename Allocator>
+void unpack(rapidjson::Value &value, Allocator &allocator) {
+    auto type = packedType(value);
+    if (type == kPackedNone) return;
+
+    const char *str = value.GetString();
+    const uint32_t count = packedCount(str);
+    rapidjson::Value array(rapidjson::kArrayType);
+    array.Reserve(count, allocator);
+    for (uint32_t i = 0; i < count; ++i) {
+        rapidjson::Value element;
+        packedElement(str, type, i, element);
+        array.PushBack(element, allocator);
+    }
+    value.Swap(array);
+}
+
+/// 在同类型紧凑数组末尾追加count个元素，容量不足时按两倍扩容
+template<typename Allocator>
+void packedAppend(rapidjson::Value &value, const void *data, size_t count, Allocator &allocator) {
+    auto type = packedType(value);
+    const size_t size = packedElementSize(type);
+    auto str = const_cast<char*>(value.GetString());
+    const uint32_t used = packedCount(str);
+    const size_t capacity = (value.GetStringLength() - kPackedHeader) / size;
+
+    if (used + count > capacity) {
+        std::string buffer;
+        writePacked(buffer, type, str + kPackedHeader, used, std::max(capacity * 2, used + count));
+        memcpy(&buffer[kPackedHeader + used * size], data, count * size);
+        auto total = static_cast<uint32_t>(used + count);
+        memcpy(&buffer[4], &total, sizeof(total));
+        value.SetString(buffer.data(), static_cast<rapidjson::SizeType>(buffer.size()), allocator);
+        return;
+    }
+
+    memcpy(str + kPackedHeader + used * size, data, count * size);
+    auto total = static_cast<uint32_t>(used + count);
+    memcpy(str + 4, &total, sizeof(total));
+}
+
+/// 遍历时把延迟解码的数字还原成RawNumber事件，紧凑数组展开为数组事件，其余事件原样转发
+template<typename Handler>
+class AcceptHandler {
+public:
+    explicit AcceptHandler(Handler &handler) : _handler(handler) {}
+
+    bool Null() { return _handler.Null(); }
+    bool Bool(bool b) { return _handler.Bool(b); }
+    bool Int(int i) { return _handler.Int(i); }
+    bool Uint(unsigned u) { return _handler.Uint(u); }
+    bool Int64(int64_t i) { return _handler.Int64(i); }
+    bool Uint64(uint64_t u) { return _handler.Uint64(u); }
+    bool Double(double d) { return _handler.Double(d); }
+    bool RawNumber(const char *str, rapidjson::SizeType length, bool copy) { return _handler.RawNumber(str, length, copy); }
+    bool String(const char *str, rapidjson::SizeType length, bool copy) {
+        if (isRawNumber(str, length)) return _handler.RawNumber(str + 1, length - 1, copy);
+        auto type = packedType(str, length);
+        if (type != kPackedNone) return packed(str, type);
+        return _handler.String(str, length, copy);
+    }
+    bool StartObject() { return _handler.StartObject(); }
+    bool Key(const char *str, rapidjson::SizeType length, bool copy) { return _handler.Key(str, length, copy); }
+    bool EndObject(rapidjson::SizeType memberCount) { return _handler.EndObject(memberCount); }
+    bool StartArray() { return _handler.StartArray(); }
+    bool EndArray(rapidjson::SizeType elementCount) { return _handler.EndArray(elementCount); }
+
+private:
+    bool packed(const char *str, RPackedType type) {
+        const uint32_t count = packedCount(str);
+        const char *data = str + kPackedHeader;
+        if (!_handler.StartArray()) return false;
+        for (uint32_t i = 0; i < count; ++i) {
+            bool ok = true;
+            if (type == kPackedInt32) {
+                int32_t v;
+                memcpy(&v, data + i * sizeof(v), sizeof(v));
+                ok = _handler.Int(v);
+            } else if (type == kPackedInt64) {
+                int64_t v;
+                memcpy(&v, data + i * sizeof(v), sizeof(v));
+                ok = _handler.Int64(v);
+            } else {
+                double v;
+                memcpy(&v, data + i * sizeof(v), sizeof(v));
+                ok = _handler.Double(v);
+            }
+            if (!ok) return false;
+        }
+        return _handler.EndArray(count);
+    }
+
+private:
+    Handler &_handler;
+};
+
+/**
+ * @brief KeyPool是文档级的key字典，相同的key在分配器中只保存一份，对象成员名以常量字符串引用共享的副本。
+ * 长度不超过kInlineLength的key由rapidjson直接保存在Value内部，本身不占用分配器内存，因此不做共享。
+ * 共享的key与分配器同生命周期，KeyPool只保存索引。
+ */
+class KeyPool {
+public:
+    /// rapidjson短字符串的最大长度，与rapidjson::Value的ShortString一致
+    static const size_t kInlineLength = sizeof(rapidjson::Value) - sizeof(uint16_t) - 1;
+
+    explicit KeyPool(rapidjson::MemoryPoolAllocator<> *allocator) : _allocator(allocator) {}
+
+    /// 返回key的共享副本，不存在时在分配器中创建；短key或者已关闭时返回nullptr
+    const char* intern(const char *str, size_t length) {
+        if (!_enabled || length <= kInlineLength) return nullptr;
+
+        auto iter = _keys.find(Key{str, length});
+        if (iter != _keys.end()) return iter->str;
+
+        auto copy = static_cast<char*>(_allocator->Malloc(length + 1));
+        memcpy(copy, str, length);
+        copy[length] = '\0';
+        _keys.insert(Key{copy, length});
+        return copy;
+    }
+
+    /// 构造成员名，长key引用共享副本，短key直接拷贝
+    void makeKey(rapidjson::Value &name, const char *str, size_t length) {
+        auto interned = intern(str, length);
+        if (interned != nullptr)
+            name.SetString(rapidjson::StringRef(interned, length));
+        else
+            name.SetString(str, static_cast<rapidjson::SizeType>(length), *_allocator);
+    }
+
+    size_t size() const { return _keys.size(); }
+
+    /// 关闭后不再共享新的key，已共享的key仍然有效。RValue保存着KeyPool的指针，因此关闭时不能释放对象
+    void setEnabled(bool enabled) { _enabled = enabled; }
+    bool enabled() const { return _enabled; }
+
+private:
+    struct Key {
+        const char *str;
+        size_t length;
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            //FNV-1a
+            uint64_t hash = 14695981039346656037ULL;
+            for (size_t i = 0; i < key.length; ++i) {
+                hash ^= static_cast<unsigned char>(key.str[i]);
+                hash *= 1099511628211ULL;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+    struct KeyEqual {
+        bool operator()(const Key &a, const Key &b) const {
+            return a.length == b.length && memcmp(a.str, b.str, a.length) == 0;
+        }
+    };
+
+    rapidjson::MemoryPoolAllocator<> *_allocator;
+    std::unordered_set<Key, KeyHash, KeyEqual> _keys;
+    bool _enabled = true;
+};
+
+/// 深拷贝src到dst，keys不为空时成员名使用共享的key，常量字符串总是拷贝
+inline void copyValue(rapidjson::Value &dst, const rapidjson::Value &src,
+                      rapidjson::MemoryPoolAllocator<> &allocator, KeyPool *keys) {
+    if (keys == nullptr) {
+        dst.CopyFrom(src, allocator, true);
+    } else if (src.IsObject()) {
+        dst.SetObject();
+        dst.MemberReserve(src.MemberCount(), allocator);
+        for (auto iter = src.MemberBegin(); iter != src.MemberEnd(); ++iter) {
+            rapidjson::Value name;
+            keys->makeKey(name, iter->name.GetString(), iter->name.GetStringLength());
+            rapidjson::Value value;
+            copyValue(value, iter->value, allocator, keys);
+            dst.AddMember(name, value, allocator);
+        }
+    } else if (src.IsArray()) {
+        dst.SetArray();
+        dst.Reserve(src.Size(), allocator);
+        for (auto iter = src.Begin(); iter != src.End(); ++iter) {
+            rapidjson::Value value;
+            copyValue(value, *iter, allocator, keys);
+            dst.PushBack(value, allocator);
+        }
+    } else {
+        dst.CopyFrom(src, allocator, true);
+    }
+}
+
+/// 估算value在分配器中占用的字节数，与copyValue的分配方式一致。
+/// interned不为空时表示拷贝会共享key，成员名按指针去重，同一个共享key只计算一次
+inline size_t liveBytes(const rapidjson::Value &value, std::unordered_set<const char*> *interned = nullptr) {
+    //rapidjson::MemoryPoolAllocator按8字节对齐分配
+    auto align = [](size_t n) { return (n + 7) & ~static_cast<size_t>(7); };
+    size_t bytes = 0;
+    if (value.IsObject()) {
+        bytes += align(value.MemberCount() * sizeof(rapidjson::Value::Member));
+        for (auto iter = value.MemberBegin(); iter != value.MemberEnd(); ++iter) {
+            const rapidjson::Value &name = iter->name;
+            if (interned == nullptr || name.GetStringLength() <= KeyPool::kInlineLength || interned->insert(name.GetString()).second)
+                bytes += liveBytes(name);
+            bytes += liveBytes(iter->value, interned);
+        }
+    } else if (value.IsArray()) {
+        bytes += align(value.Size() * sizeof(rapidjson::Value));
+        for (auto iter = value.Begin(); iter != value.End(); ++iter)
+            bytes += liveBytes(*iter, interned);
+    } else if (value.IsString() && value.GetStringLength() > KeyPool::kInlineLength) {
+        bytes += align(value.GetStringLength() + 1);
+    }
+    return bytes;
+}
+
+/// RDocument::compact()使用的分配器，先用完按存活数据大小申请的缓冲区，之后按默认块大小增长
+struct Arena {
+    /// 缓冲区中分配器自身的块头占用
+    static const size_t kOverhead = 128;
+
+    explicit Arena(size_t size)
+        : buffer(new char[size + kOverhead]), allocator(buffer.get(), size + kOverhead) {}
+
+    std::unique_ptr<char[]> buffer;
+    rapidjson::MemoryPoolAllocator<> allocator;
+};
+
+/// 查找key对应的成员，不存在时插入null成员，object必须是Object类型
+inline rapidjson::Value& member(rapidjson::Value &object, const std::string &key,
+                                rapidjson::MemoryPoolAllocator<> &allocator, KeyPool *keys) {
+    rapidjson::Value name(rapidjson::StringRef(key.c_str(), key.size()));
+    auto iter = object.FindMember(name);
+    if (iter != object.MemberEnd()) return iter->value;
+
+    //必须拷贝key内容
+    rapidjson::Value lvalue;
+    if (keys != nullptr)
+        keys->makeKey(lvalue, key.c_str(), key.size());
+    else
+        lvalue.SetString(key.c_str(), static_cast<rapidjson::SizeType>(key.size()), allocator);
+    object.AddMember(lvalue, rapidjson::Value(), allocator);
+    return (object.MemberEnd() - 1)->value;
+}
+
+/// 解析时构造文档，RawNumber事件保存为带kRawNumberTag的字符串，keys不为空时共享key，其余事件交给rapidjson::Document处理。
+/// 首字节是内部标记的字符串值中止解析，result()把中止转换为kParseErrorStringInvalidEncoding。
+/// pack为true时数组先缓存数字元素，到数组结束时全部为同类数字则保存为紧凑数组，遇到其他元素时把缓存的元素补发给文档。
+class DocumentHandler {
+public:
+    explicit DocumentHandler(rapidjson::Document &doc, KeyPool *keys = nullptr, bool pack = false)
+        : _doc(doc), _keys(keys), _pack(pack) {}
+
+    bool Null() { return flush() && _doc.Null(); }
+    bool Bool(bool b) { return flush() && _doc.Bool(b); }
+    bool Int(int i) { return _pending ? packInt(i) : _doc.Int(i); }
+    bool Uint(unsigned u) { return _pending ? packInt(u) : _doc.Uint(u); }
+    bool Int64(int64_t i) { return _pending ? packInt(i) : _doc.Int64(i); }
+    bool Uint64(uint64_t u) {
+        if (_pending && u <= static_cast<uint64_t>(INT64_MAX)) return packInt(static_cast<int64_t>(u));
+        return flush() && _doc.Uint64(u);
+    }
+    bool Double(double d) {
+        if (_pending && _ints.empty()) {
+            _doubles.push_back(d);
+            return true;
+        }
+        return flush() && _doc.Double(d);
+    }
+    bool RawNumber(const char *str, rapidjson::SizeType length, bool) {
+        if (!flush()) return false;
+        _buffer.assign(1, kRawNumberTag);
+        _buffer.append(str, length);
+        return _doc.String(_buffer.c_str(), static_cast<rapidjson::SizeType>(_buffer.size()), true);
+    }
+    bool String(const char *str, rapidjson::SizeType length, bool copy) {
+        if (isReservedString(str, length)) {
+            _reserved = true;
+            return false;
+        }
+        return flush() && _doc.String(str, length, copy);
+    }
+    bool StartObject() {
+        ++_depth;
+        return flush() && _doc.StartObject();
+    }
+    bool Key(const char *str, rapidjson::SizeType length, bool copy) {
+        if (_keys != nullptr) {
+            auto interned = _keys->intern(str, length);
+            //不拷贝，直接引用共享的key
+            if (interned != nullptr) return _doc.String(interned, length, false);
+        }
+        return _doc.Key(str, length, copy);
+    }
+    bool EndObject(rapidjson::SizeType memberCount) {
+        --_depth;
+        return _doc.EndObject(memberCount);
+    }
+    bool StartArray() {
+        if (!flush()) return false;
+        //根节点不压缩，RDocument的数组接口直接操作根节点
+        bool nested = _depth++ > 0;
+        if (_pack && nested) {
+            _pending = true;
+            _ints.clear();
+            _doubles.clear();
+            _int32 = true;
+            return true;
+        }
+        return _doc.StartArray();
+    }
+    bool EndArray(rapidjson::SizeType elementCount) {
+        --_depth;
+        if (_pending && elementCount >= kPackedMinCount) {
+            _pending = false;
+            if (!_doubles.empty()) {
+                writePacked(_buffer, kPackedDouble, _doubles.data(), _doubles.size(), _doubles.size());
+            } else if (_int32) {
+                std::vector<int32_t> values(_ints.begin(), _ints.end());
+                writePacked(_buffer, kPackedInt32, values.data(), values.size(), values.size());
+            } else {
+                writePacked(_buffer, kPackedInt64, _ints.data(), _ints.size(), _ints.size());
+            }
+            return _doc.String(_buffer.data(), static_cast<rapidjson::SizeType>(_buffer.size()), true);
+        }
+        return flush() && _doc.EndArray(elementCount);
+    }
+
+    /// reader返回的解析结果，因内部标记字符串中止时给出具体错误
+    rapidjson::ParseResult result(const rapidjson::ParseResult &r) const {
+        if (_reserved && r.Code() == rapidjson::kParseErrorTermination)
+            return rapidjson::ParseResult(rapidjson::kParseErrorStringInvalidEncoding, r.Offset());
+        return r;
+    }
+
+private:
+    bool packInt(int64_t i) {
+        if (!_doubles.empty()) return flush() && _doc.Int64(i);
+        if (i < INT32_MIN || i > INT32_MAX) _int32 = false;
+        _ints.push_back(i);
+        return true;
+    }
+
+    /// 放弃压缩当前数组，补发数组开始和已缓存的元素
+    bool flush() {
+        if (!_pending) return true;
+        _pending = false;
+        if (!_doc.StartArray()) return false;
+        for (auto i : _ints)
+            if (!_doc.Int64(i)) return false;
+        for (auto d : _doubles)
+            if (!_doc.Double(d)) return false;
+        return true;
+    }
+
+private:
+    rapidjson::Document &_doc;
+    KeyPool *_keys;
+    std::string _buffer;
+
+    bool _pack;
+    bool _reserved = false;
+    /// 当前打开的容器层数
+    int _depth = 0;
+    /// 最内层数组正在缓存元素，尚未交给文档
+    bool _pending = false;
+    bool _int32 = true;
+    std::vector<int64_t> _ints;
+    std::vector<double> _doubles;
+};
+
+/// 输出JSON文本，RawNumber原样写出，不加引号
+template<typename OutputStream, unsigned writeFlags = rapidjson::kWriteDefaultFlags>
+class JsonWriter : public rapidjson::Writer<OutputStream, rapidjson::UTF8<>, rapidjson::UTF8<>, rapidjson::CrtAllocator, writeFlags> {
+    typedef rapidjson::Writer<OutputStream, rapidjson::UTF8<>, rapidjson::UTF8<>, rapidjson::CrtAllocator, writeFlags> Base;
+
+public:
+    explicit JsonWriter(OutputStream &os) : Base(os) {}
+
+    bool RawNumber(const char *str, rapidjson::SizeType length, bool) {
+        return Base::RawValue(str, length, rapidjson::kNumberType);
+    }
+};
+
+/// 结构哈希使用的常量，固定取值，保证哈希值跨进程和平台稳定
+const uint64_t kHashNull = 0x6e756c6c00000001ULL;
+const uint64_t kHashFalse = 0x66616c7365000002ULL;
+const uint64_t kHashTrue = 0x7472756500000003ULL;
+const uint64_t kHashNumber = 0x6e756d6265720004ULL;
+const uint64_t kHashString = 0x7374720000000005ULL;
+const uint64_t kHashArray = 0x6172726179000006ULL;
+const uint64_t kHashObject = 0x6f626a6563740007ULL;
+
+/// splitmix64的最终混合函数
+inline uint64_t mixHash(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/// FNV-1a
+inline uint64_t hashBytes(const char *str, size_t length, uint64_t seed) {
+    uint64_t hash = 14695981039346656037ULL ^ seed;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(str[i]);
+        hash *= 1099511628211ULL;
+    }
+    return mixHash(hash);
+}
+
+/// 数字按double计算，与operator==中整数和浮点数按值比较一致
+inline uint64_t hashNumber(double d) {
+    if (d == 0) d = 0;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return mixHash(bits ^ kHashNumber);
+}
+
+/// 按数值比较两个数字。rapidjson对两个整数比较原始位，Int64(-1)与Uint64(UINT64_MAX)会相等，与hashNumber()不一致
+inline bool numberEqual(const rapidjson::Value &a, const rapidjson::Value &b) {
+    if (a.IsDouble() || b.IsDouble()) return a.GetDouble() == b.GetDouble();
+    //非负整数同时是Uint64，只有负数和超过INT64_MAX的值不能互相表示
+    if (a.IsUint64() && b.IsUint64()) return a.GetUint64() == b.GetUint64();
+    if (a.IsInt64() && b.IsInt64()) return a.GetInt64() == b.GetInt64();
+    return false;
+}
+
+/**
+ * @brief HashCache是文档级的子树哈希缓存，按节点地址保存对象、数组的哈希值，默认关闭。
+ * 文档的任何修改都使缓存整体失效：只增加版本号，旧的记录在下一次写入时清除。
+ * RValue只保存节点指针，不知道父节点，无法只让被修改节点的祖先失效，
+ * 因此频繁修改的文档每次修改后都要重新计算整棵树，缓存只对读多写少的文档有效。
+ */
+class HashCache {
+public:
+    bool find(const rapidjson::Value *value, uint64_t &hash) const {
+        if (!_enabled || _filled != _generation) return false;
+        auto iter = _hashes.find(value);
+        if (iter == _hashes.end()) return false;
+        hash = iter->second;
+        return true;
+    }
+
+    void insert(const rapidjson::Value *value, uint64_t hash) {
+        if (!_enabled) return;
+        if (_filled != _generation) {
+            _hashes.clear();
+            _filled = _generation;
+        }
+        _hashes[value] = hash;
+    }
+
+    void invalidate() { ++_generation; }
+    size_t size() const { return _filled == _generation ? _hashes.size() : 0; }
+
+    /// 关闭后不再查找和写入，并释放已缓存的哈希值。RValue保存着HashCache的指针，因此关闭时不能释放对象
+    void setEnabled(bool enabled) {
+        _enabled = enabled;
+        if (!enabled) {
+            std::unordered_map<const rapidjson::Value*, uint64_t>().swap(_hashes);
+            invalidate();
+        }
+    }
+    bool enabled() const { return _enabled; }
+
+private:
+    std::unordered_map<const rapidjson::Value*, uint64_t> _hashes;
+    bool _enabled = false;
+    uint64_t _generation = 0;
+    uint64_t _filled = 0;
+};
+}
+
+/// 字符串列的元素，引用文档中的字符串，生命周期不能超过文档
+struct RStringView {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    RStringView() {}
+    RStringView(const char* d, size_t s) : data(d), size(s) {}
+    std::string toString() const { return std::string(data != nullptr ? data : "", size); }
+};
+
+/// 紧凑数组的连续元素，引用文档中的内存，数组被修改后失效
+template<typename T>
+struct RSpan {
+    T* data = nullptr;
+    size_t size = 0;
+
+    RSpan() {}
+    RSpan(T* d, size_t s) : data(d), size(s) {}
+    T* begin() const { return data; }
+    T* end() const { return data + size; }
+    T& operator[](size_t i) const { return data[i]; }
+    bool empty() const { return size == 0; }
+};
+
+/**
+ * @brief RColumns描述对象数组中字段与列之间的映射，用于按列批量读取或者构造对象数组。
+ * 每个字段对应一个调用方持有的std::vector，读取时一次遍历数组填充所有列，
+ * 字段不存在或者类型不匹配时填入默认值；构造时每行生成一个对象。
+ * @code 典型用法
+ *      std::vector<double> amp;
+ *      std::vector<int64_t> size;
+ *      std::vector<RStringView> name;
+ *      RColumns columns;
+ *      columns.add("amp", &amp).add("size", &size).add("name", &name);
+ *      doc["values"].extractColumns(columns, 4);
+ *
+ *      RDocument out;
+ *      out.appendColumns(columns);
+ */
+class RColumns {
+public:
+    RColumns& add(const std::string &name, std::vector<double>* column, double defaultValue = 0) {
+        Field field(name, Type::Double);
+        field.doubles = column;
+        field.defaultDouble = defaultValue;
+        _fields.push_back(field);
+        return *this;
+    }
+    RColumns& add(const std::string &name, std::vector<int64_t>* column, int64_t defaultValue = 0) {
+        Field field(name, Type::Int64);
+        field.ints = column;
+        field.defaultInt = defaultValue;
+        _fields.push_back(field);
+        return *this;
+    }
+    /// 字符串视图列，不拷贝字符串内容
+    RColumns& add(const std::string &name, std::vector<RStringView>* column) {
+        Field field(name, Type::StringView);
+        field.views = column;
+        _fields.push_back(field);
+        return *this;
+    }
+    RColumns& add(const std::string &name, std::vector<std::string>* column) {
+        Field field(name, Type::String);
+        field.strings = column;
+        _fields.push_back(field);
+        return *this;
+    }
+
+    size_t count() const { return _fields.size(); }
+
+    /// 行数，各列长度不一致时返回最短列的长度
+    size_t rows() const {
+        if (_fields.empty()) return 0;
+        size_t result = SIZE_MAX;
+        for (auto &field : _fields) result = std::min(result, field.size());
+        return result;
+    }
+
+private:
+    enum class Type { Double, Int64, StringView, String };
+
+    struct Field {
+        Field(const std::string &n, Type t) : name(n), type(t) {}
+
+        size_t size() const {
+            switch (type) {
+            case Type::Double: return doubles->size();
+            case Type::Int64: return ints->size();
+            case Type::StringView: return views->size();
+            case Type::String: return strings->size();
+            }
+            return 0;
+        }
+
+        std::string name;
+        Type type;
+        std::vector<double>* doubles = nullptr;
+        std::vector<int64_t>* ints = nullptr;
+        std::vector<RStringView>* views = nullptr;
+        std::vector<std::string>* strings = nullptr;
+        double defaultDouble = 0;
+        int64_t defaultInt = 0;
+    };
+
+    /// 按列构造对象并追加到array，array必须是Array类型
+    void appendTo(rapidjson::Value &array, rapidjson::MemoryPoolAllocator<> &allocator, detail::KeyPool *keys) const {
+        auto &fields = _fields;
+
+        //成员名只构造一次，长名字引用同一份拷贝
+        std::vector<rapidjson::Value> names(fields.size());
+        for (size_t f = 0; f < fields.size(); ++f) {
+            auto &name = fields[f].name;
+            const char *shared = keys != nullptr ? keys->intern(name.c_str(), name.size()) : nullptr;
+            if (shared == nullptr && name.size() > detail::KeyPool::kInlineLength) {
+                auto copy = static_cast<char*>(allocator.Malloc(name.size() + 1));
+                memcpy(copy, name.c_str(), name.size() + 1);
+                shared = copy;
+            }
+            if (shared != nullptr)
+                names[f].SetString(rapidjson::StringRef(shared, name.size()));
+            else
+                names[f].SetString(name.c_str(), static_cast<rapidjson::SizeType>(name.size()), allocator);
+        }
+
+        const size_t count = rows();
+        array.Reserve(static_cast<rapidjson::SizeType>(array.Size() + count), allocator);
+        for (size_t row = 0; row < count; ++row) {
+            rapidjson::Value object(rapidjson::kObjectType);
+            object.MemberReserve(static_cast<rapidjson::SizeType>(fields.size()), allocator);
+            for (size_t f = 0; f < fields.size(); ++f) {
+                auto &field = fields[f];
+                rapidjson::Value name;
+                name.CopyFrom(names[f], allocator);
+                rapidjson::Value value;
+                switch (field.type) {
+                case Type::Double: value.SetDouble((*field.doubles)[row]); break;
+                case Type::Int64: value.SetInt64((*field.ints)[row]); break;
+                case Type::StringView: {
+                    auto &view = (*field.views)[row];
+                    if (!detail::setString(value, view.data != nullptr ? view.data : "", view.size, allocator))
+                        printf("RColumns append error, field:%s, row:%u, string starts with invalid UTF-8 byte.\n", field.name.c_str(), (unsigned int)row);
+                    break;
+                }
+                case Type::String: {
+                    auto &str = (*field.strings)[row];
+                    if (!detail::setString(value, str.c_str(), str.size(), allocator))
+                        printf("RColumns append error, field:%s, row:%u, string starts with invalid UTF-8 byte.\n", field.name.c_str(), (unsigned int)row);
+                    break;
+                }
+                }
+                object.AddMember(name, value, allocator);
+            }
+            array.PushBack(object, allocator);
+        }
+    }
+
+    friend class RConstValue;
+    template<typename> friend class GenericRValue;
+    friend class RDocument;
+    std::vector<Field> _fields;
+};
+
+/**
+ * @brief RConstValue类是JSON值的只读视图，不持有也不修改所引用的值。
+ * 与RValue::operator[]不同，find()和at()查找失败时不会插入新成员，而是返回无效视图(isValid()为false)，
+ * 因此多个线程可以无锁地同时读取同一个文档，只要期间没有线程修改它。
+ * 视图的生命周期不能超过其所引用的文档。
+ * @code 典型用法
+ *      auto doc = RDocument::fromJson(txt.c_str(), txt.size());
+ *      auto name = doc.find("names").at(0).find("name");
+ *      if (name)
+ *          printf("%s\n", name.toString().c_str());
+ */
+class RConstValue {
+public:
+    RConstValue() {}
+    explicit RConstValue(const rapidjson::Value* value) : _value(value) {}
+
+    /// 视图是否引用了某个值，查找失败时为false
+    bool isValid() const { return _value != nullptr; }
+    explicit operator bool() const { return isValid(); }
+
+    //判断值类型，无效视图均返回false，紧凑数组也是数组
+    bool isArray() const { return _value != nullptr && !isElement() && (_value->IsArray() || detail::isPacked(*_value)); }
+    bool isBool() const { return _value != nullptr && _value->IsBool(); }
+    bool isDouble() const {
+        if (_value == nullptr) return false;
+        rapidjson::Value temp;
+        return scalar(temp).IsDouble();
+    }
+    bool isNull() const { return _value != nullptr && _value->IsNull(); }
+    bool isNumber() const { return _value != nullptr && (isElement() || _value->IsNumber() || detail::isRawNumber(*_value)); }
+    bool isObject() const { return _value != nullptr && _value->IsObject(); }
+    bool isString() const {
+        return _value != nullptr && !isElement() && detail::isPlainString(*_value);
+    }
+    /// 紧凑数组的元素类型，其他值返回kPackedNone
+    RPackedType packedType() const { return _value != nullptr && !isElement() ? detail::packedType(*_value) : kPackedNone; }
+
+    //值转换，无效视图或类型不匹配时返回默认值，延迟解码的数字在此解码
+    bool toBool(bool defaultValue = false) const {
+        if (!isBool()) return defaultValue;
+        return _value->GetBool();
+    }
+    /// 任意数字类型都可以转换成double，整数不再返回默认值
+    double toDouble(double defaultValue = 0) const {
+        if (_value == nullptr) return defaultValue;
+        if (_value->IsDouble()) return _value->GetDouble();
+
+        rapidjson::Value temp;
+        auto &v = scalar(temp);
+        if (!v.IsNumber()) return defaultValue;
+        return v.GetDouble();
+    }
+    int toInt(int defaultValue = 0) const {
+        if (_value == nullptr) return defaultValue;
+        rapidjson::Value temp;
+        auto &v = scalar(temp);
+        if (!v.IsInt()) return defaultValue;
+        return v.GetInt();
+    }
+    unsigned int toUInt(unsigned int defaultValue = 0) const {
+        if (_value == nullptr) return defaultValue;
+        rapidjson::Value temp;
+        auto &v = scalar(temp);
+        if (!v.IsUint()) return defaultValue;
+        return v.GetUint();
+    }
+    long long toLonglong(long long defaultValue = 0) const {
+        if (_value == nullptr) return defaultValue;
+        rapidjson::Value temp;
+        auto &v = scalar(temp);
+        if (!v.IsInt64()) return defaultValue;
+        return v.GetInt64();
+    }
+    unsigned long long toULonglong(unsigned long long defaultValue = 0) const {
+        if (_value == nullptr) return defaultValue;
+        rapidjson::Value temp;
+        auto &v = scalar(temp);
+        if (!v.IsUint64()) return defaultValue;
+        return v.GetUint64();
+    }
+    std::string toString(const std::string &defaultValue = "") const {
+        if (!isString()) return defaultValue;
+        return std::string(_value->GetString(), _value->GetStringLength());
+    }
+
+    //对象类型只读操作
+    /// 按照key查找成员，不存在或者不是Object类型时返回无效视图
+    RConstValue find(const std::string &key) const {
+        if (!isObject()) return {};
+
+        rapidjson::Value name(rapidjson::StringRef(key.c_str(), key.size()));
+        auto iter = _value->FindMember(name);
+        if (iter == _value->MemberEnd()) return {};
+        return RConstValue(&iter->value);
+    }
+
+    bool contains(const std::string &key) const { return find(key).isValid(); }
+
+    std::vector<std::string> keys() const {
+        if (!isObject()) return {};
+
+        std::vector<std::string> result;
+        result.reserve(_value->MemberCount());
+        for (auto iter = _value->MemberBegin(); iter != _value->MemberEnd(); ++iter) {
+            result.push_back(iter->name.GetString());
+        }
+        return result;
+    }
+
+    //数组类型只读操作
+    /// 按照下标索引，越界或者不是Array类型时返回无效视图
+    RConstValue at(unsigned int i) const {
+        if (!isArray() || i >= size()) return {};
+        if (packedType() != kPackedNone) return RConstValue(_value, i);
+        return RConstValue(&(*_value)[i]);
+    }
+
+    unsigned int size() const {
+        if (!isArray()) return 0;
+        if (packedType() != kPackedNone) return detail::packedCount(_value->GetString());
+        return _value->Size();
+    }
+
+    /// 紧凑数组元素的连续内存，T为int32_t、int64_t或double，类型不一致或者不是紧凑数组时返回空
+    template<typename T>
+    RSpan<const T> span() const {
+        if (packedType() != detail::PackedTypeOf<T>::value || packedType() == kPackedNone) return {};
+        auto str = _value->GetString();
+        return RSpan<const T>(reinterpret_cast<const T*>(str + detail::kPackedHeader), detail::packedCount(str));
+    }
+
+    /**
+     * @brief operator==按值比较，对象成员与顺序无关，整数与浮点数按值比较，延迟解码的数字和紧凑数组按逻辑值比较。
+     * 对象成员顺序相同时按位置直接比较成员名，不需要逐个查找。
+     */
+    bool operator==(const RConstValue &other) const {
+        if (_value == nullptr || other._value == nullptr) return _value == other._value;
+        if (_value == other._value && _element == other._element) return true;
+
+        if (isNumber() || other.isNumber()) {
+            if (!isNumber() || !other.isNumber()) return false;
+            rapidjson::Value a, b;
+            return detail::numberEqual(scalar(a), other.scalar(b));
+        }
+        if (isArray() || other.isArray()) {
+            if (!isArray() || !other.isArray()) return false;
+            const unsigned int count = size();
+            if (count != other.size()) return false;
+            auto type = packedType();
+            if ((type == kPackedInt32 || type == kPackedInt64) && type == other.packedType()) {
+                return memcmp(_value->GetString() + detail::kPackedHeader, other._value->GetString() + detail::kPackedHeader,
+                              count * detail::packedElementSize(type)) == 0;
+            }
+            for (unsigned int i = 0; i < count; ++i) {
+                if (at(i) != other.at(i)) return false;
+            }
+            return true;
+        }
+        if (_value->GetType() != other._value->GetType()) return false;
+        if (_value->IsString()) {
+            return _value->GetStringLength() == other._value->GetStringLength()
+                    && memcmp(_value->GetString(), other._value->GetString(), _value->GetStringLength()) == 0;
+        }
+        if (_value->IsObject()) {
+            const rapidjson::SizeType count = _value->MemberCount();
+            if (count != other._value->MemberCount()) return false;
+            auto members = _value->MemberBegin();
+            auto others = other._value->MemberBegin();
+            for (rapidjson::SizeType i = 0; i < count; ++i) {
+                auto &name = members[i].name;
+                const rapidjson::Value *match = nullptr;
+                if (sameName(others[i].name, name)) {
+                    match = &others[i].value;
+                } else {
+                    auto iter = other._value->FindMember(name);
+                    if (iter == other._value->MemberEnd()) return false;
+                    match = &iter->value;
+                }
+                if (RConstValue(&members[i].value) != RConstValue(match)) return false;
+            }
+        }
+        return true;
+    }
+    bool operator!=(const RConstValue &other) const { return !(*this == other); }
+
+    /**
+     * @brief hash计算结构哈希，与operator==一致：相等的值哈希相同。
+     * 对象与成员顺序无关，数字按double计算，延迟解码的数字和紧凑数组按逻辑值计算，结果跨进程和平台稳定。
+     * 每次调用都遍历整个子树；需要重复计算时使用RDocument::setHashCaching()开启缓存。
+     */
+    uint64_t hash() const { return hashValue(nullptr); }
+
+    /**
+     * @brief extractColumns把对象数组按列读取到columns中，每列长度等于数组长度。
+     * 遍历时记住每个字段上一次出现的成员位置，结构相同的对象只需比较一次即可命中。
+     * @param threads大于1时按行切分给多个线程并行填充
+     * @return 当前值不是数组时返回false
+     */
+    bool extractColumns(const RColumns &columns, unsigned int threads = 1) const {
+        if (!isArray()) return false;
+
+        const size_t rows = size();
+        for (auto &field : columns._fields) {
+            switch (field.type) {
+            case RColumns::Type::Double: field.doubles->assign(rows, field.defaultDouble); break;
+            case RColumns::Type::Int64: field.ints->assign(rows, field.defaultInt); break;
+            case RColumns::Type::StringView: field.views->assign(rows, RStringView()); break;
+            case RColumns::Type::String: field.strings->assign(rows, std::string()); break;
+            }
+        }
+
+        //紧凑数组的元素都不是对象，全部为默认值
+        if (packedType() != kPackedNone) return true;
+
+        //每个线程至少处理4096行，避免线程开销超过收益
+        const size_t minRows = 4096;
+        size_t workers = threads == 0 ? 1 : threads;
+        workers = std::min(workers, (rows + minRows - 1) / minRows);
+        if (workers <= 1) {
+            extractRows(columns, 0, rows);
+            return true;
+        }
+
+        std::vector<std::thread> pool;
+        const size_t step = (rows + workers - 1) / workers;
+        for (size_t begin = step; begin < rows; begin += step) {
+            pool.emplace_back(&RConstValue::extractRows, this, std::cref(columns), begin, std::min(rows, begin + step));
+        }
+        extractRows(columns, 0, step);
+        for (auto &thread : pool) thread.join();
+        return true;
+    }
+
+    /// 以SAX方式遍历当前值，handler接口与rapidjson的Handler相同，延迟解码的数字以RawNumber事件给出
+    template<typename Handler>
+    bool accept(Handler &handler) const {
+        if (_value == nullptr) return false;
+        if (isElement()) {
+            rapidjson::Value temp;
+            return scalar(temp).Accept(handler);
+        }
+        detail::AcceptHandler<Handler> filter(handler);
+        return _value->Accept(filter);
+    }
+
+private:
+    void extractRows(const RColumns &columns, size_t begin, size_t end) const {
+        auto &fields = columns._fields;
+        std::vector<rapidjson::SizeType> hints(fields.size(), 0);
+
+        for (size_t row = begin; row < end; ++row) {
+            auto &object = (*_value)[static_cast<rapidjson::SizeType>(row)];
+            if (!object.IsObject()) continue;
+
+            auto members = object.MemberBegin();
+            const rapidjson::SizeType count = object.MemberCount();
+            for (size_t f = 0; f < fields.size(); ++f) {
+                auto &field = fields[f];
+                //优先检查上一行中该字段所在的位置
+                rapidjson::SizeType index = hints[f];
+                if (index >= count || !sameName(members[index].name, field.name)) {
+                    index = count;
+                    for (rapidjson::SizeType m = 0; m < count; ++m) {
+                        if (sameName(members[m].name, field.name)) {
+                            index = m;
+                            break;
+                        }
+                    }
+                    if (index == count) continue;
+                    hints[f] = index;
+                }
+
+                auto &value = members[index].value;
+                switch (field.type) {
+                case RColumns::Type::Double: {
+                    rapidjson::Value temp;
+                    auto &v = detail::number(value, temp);
+                    if (v.IsNumber()) (*field.doubles)[row] = v.GetDouble();
+                    break;
+                }
+                case RColumns::Type::Int64: {
+                    rapidjson::Value temp;
+                    auto &v = detail::number(value, temp);
+                    if (v.IsInt64()) (*field.ints)[row] = v.GetInt64();
+                    break;
+                }
+                case RColumns::Type::StringView:
+                    if (detail::isPlainString(value))
+                        (*field.views)[row] = RStringView(value.GetString(), value.GetStringLength());
+                    break;
+                case RColumns::Type::String:
+                    if (detail::isPlainString(value))
+                        (*field.strings)[row].assign(value.GetString(), value.GetStringLength());
+                    break;
+                }
+            }
+        }
+    }
+
+    static bool sameName(const rapidjson::Value &name, const std::string &key) {
+        return name.GetStringLength() == key.size() && memcmp(name.GetString(), key.c_str(), key.size()) == 0;
+    }
+    static bool sameName(const rapidjson::Value &a, const rapidjson::Value &b) {
+        if (a.GetString() == b.GetString()) return a.GetStringLength() == b.GetStringLength();
+        return a.GetStringLength() == b.GetStringLength() && memcmp(a.GetString(), b.GetString(), a.GetStringLength()) == 0;
+    }
+
+    /// cache不为空时对象和数组的哈希值保存到缓存中
+    uint64_t hashValue(detail::HashCache *cache) const {
+        if (_value == nullptr) return 0;
+        if (isNumber()) {
+            rapidjson::Value temp;
+            return detail::hashNumber(scalar(temp).GetDouble());
+        }
+        if (_value->IsNull()) return detail::kHashNull;
+        if (_value->IsBool()) return _value->GetBool() ? detail::kHashTrue : detail::kHashFalse;
+        if (isString()) return detail::hashBytes(_value->GetString(), _value->GetStringLength(), detail::kHashString);
+
+        uint64_t hash = 0;
+        if (cache != nullptr && cache->find(_value, hash)) return hash;
+        if (isArray()) {
+            //数组与元素顺序有关
+            const unsigned int count = size();
+            hash = detail::kHashArray;
+            for (unsigned int i = 0; i < count; ++i)
+                hash = detail::mixHash(hash ^ at(i).hashValue(cache));
+            hash = detail::mixHash(hash + count);
+        } else {
+            //对象成员的哈希相加，与成员顺序无关
+            uint64_t sum = 0;
+            for (auto iter = _value->MemberBegin(); iter != _value->MemberEnd(); ++iter) {
+                uint64_t name = detail::hashBytes(iter->name.GetString(), iter->name.GetStringLength(), detail::kHashString);
+                sum += detail::mixHash(name ^ detail::mixHash(RConstValue(&iter->value).hashValue(cache)));
+            }
+            hash = detail::mixHash(detail::kHashObject ^ sum ^ _value->MemberCount());
+        }
+        if (cache != nullptr) cache->insert(_value, hash);
+        return hash;
+    }
+
+    /// 紧凑数组的第index个元素
+    RConstValue(const rapidjson::Value* packed, unsigned int index) : _value(packed), _element(index) {}
+    bool isElement() const { return _element != kNoElement; }
+
+    /// 返回可直接读取数值的值，紧凑数组元素和延迟解码的数字解码到temp中
+    const rapidjson::Value& scalar(rapidjson::Value &temp) const {
+        if (isElement()) {
+            detail::packedElement(_value->GetString(), detail::packedType(*_value), _element, temp);
+            return temp;
+        }
+        return detail::number(*_value, temp);
+    }
+
+private:
+    template<typename> friend class GenericRValue;
+    friend class RDocument;
+    static const unsigned int kNoElement = 0xFFFFFFFFu;
+    const rapidjson::Value* _value = nullptr;
+    /// 不为kNoElement时视图引用_value所指紧凑数组中的元素
+    unsigned int _element = kNoElement;
+};
+
 /**
  * @brief RValue类代表JSON中值类型，支持多种类型数据,例如数值类型、对象类型和数组类型。
  * @code 典型用法
@@ -75,12 +1312,16 @@ public:
             _value->CopyFrom(*other._value, *_allocator);
         _own = true;
         _allocator = other._allocator;
+        _keys = other._keys;
+        _hashes = other._hashes;
     }
 
     GenericRValue(GenericRValue &&other)
         : _value(other._value)
         , _own(other._own)
-        , _allocator(other._allocator) {
+        , _allocator(other._allocator)
+        , _keys(other._keys)
+        , _hashes(other._hashes) {
         other._value = nullptr;
         other._own = false;
     }
@@ -89,75 +1330,63 @@ public:
     }
 
     //判断值类型
-    bool isArray() const { return _value->IsArray(); }
+    bool isArray() const { return view().isArray(); }
     bool isBool() const { return _value->IsBool(); }
-    bool isDouble() const { return _value->IsDouble(); }
+    bool isDouble() const { return view().isDouble(); }
     bool isNull() const { return _value->IsNull(); }
+    bool isNumber() const { return view().isNumber(); }
     bool isObject() const { return _value->IsObject(); }
-    bool isString() const { return _value->IsString(); }
+    bool isString() const { return view().isString(); }
 
-    //值转换
-    bool toBool(bool defaultValue = false) const {
-        if (!_value->IsBool()) return defaultValue;
-        return _value->GetBool();
-    }
-    double toDouble(double defaultValue = 0) const {
-        if (!_value->IsDouble()) return defaultValue;
-        return _value->GetDouble();
-    }
-    int toInt(int defaultValue = 0) const {
-        if (!_value->IsInt()) return defaultValue;
-        return _value->GetInt();
-    }
-    unsigned int toUInt(unsigned int defaultValue = 0) const {
-        if (!_value->IsUint()) return defaultValue;
-        return _value->GetUint();
-    }
-    long long toLonglong(int defaultValue = 0) const {
-        if (!_value->IsInt64()) return defaultValue;
-        return _value->GetInt64();
-    }
-    unsigned long long toULonglong(int defaultValue = 0) const {
-        if (!_value->IsUint64()) return defaultValue;
-        return _value->GetUint64();
-    }
-    std::string toString(const std::string &defaultValue = "") const {
-        if (!_value->IsString()) return defaultValue;
-        return _value->GetString();
-    }
+    //值转换，与RConstValue一致
+    bool toBool(bool defaultValue = false) const { return view().toBool(defaultValue); }
+    double toDouble(double defaultValue = 0) const { return view().toDouble(defaultValue); }
+    int toInt(int defaultValue = 0) const { return view().toInt(defaultValue); }
+    unsigned int toUInt(unsigned int defaultValue = 0) const { return view().toUInt(defaultValue); }
+    long long toLonglong(int defaultValue = 0) const { return view().toLonglong(defaultValue); }
+    unsigned long long toULonglong(int defaultValue = 0) const { return view().toULonglong(defaultValue); }
+    std::string toString(const std::string &defaultValue = "") const { return view().toString(defaultValue); }
 
     //修改值
-    void setValue(bool b) { _value->SetBool(b); }
-    void setValue(double d) { _value->SetDouble(d); }
-    void setValue(int n) { _value->SetInt(n); }
-    void setValue(unsigned int n) { _value->SetUint(n); }
-    void setValue(long long n) { _value->SetInt64(n); }
-    void setValue(unsigned long long n) { _value->SetUint64(n); }
-    void setValue(const std::string &s) { _value->SetString(s.c_str(), static_cast<rapidjson::SizeType>(s.size()), *_allocator); }
-    void setValue(const char *s) { _value->SetString(s, static_cast<rapidjson::SizeType>(strlen(s)), *_allocator); }
-    void setValue(const char *s, int size) { _value->SetString(s, size, *_allocator); }
-    void setValue(const GenericRValue &other) { _value->CopyFrom(*other._value, *_allocator); }
-    void reset() { _value->SetNull(); }
+    void setValue(bool b) { modified(); _value->SetBool(b); }
+    void setValue(double d) { modified(); _value->SetDouble(d); }
+    void setValue(int n) { modified(); _value->SetInt(n); }
+    void setValue(unsigned int n) { modified(); _value->SetUint(n); }
+    void setValue(long long n) { modified(); _value->SetInt64(n); }
+    void setValue(unsigned long long n) { modified(); _value->SetUint64(n); }
+    /// 字符串必须是UTF-8，以0xFF开头时拒绝修改并输出错误
+    void setValue(const std::string &s) { setString(s.c_str(), s.size()); }
+    void setValue(const char *s) { setString(s, strlen(s)); }
+    void setValue(const char *s, int size) { setString(s, size); }
+    void setValue(const GenericRValue &other) { modified(); _value->CopyFrom(*other._value, *_allocator, other._allocator != _allocator); }
+    void reset() { modified(); _value->SetNull(); }
 
     /// 初始化空对象
-    void setObject() { _value->SetObject(); }
+    void setObject() { modified(); _value->SetObject(); }
     /// 初始化空数组
-    void setArray() { _value->SetArray(); }
+    void setArray() { modified(); _value->SetArray(); }
 
     //允许外部修改分配器,有可能导致崩溃，在不了解分配器原理情况下，不建议使用
     void setAllocator(Allocator* alloc) { _allocator = alloc; }
     Allocator* allocator() const { return _allocator; }
 
     //操作符相关函数
+    /// 按值比较，两边都属于开启哈希缓存的文档时先比较哈希值
     bool operator==(const GenericRValue &other) const {
-        return *_value == *other._value;
+        if (_hashes != nullptr && _hashes->enabled() && other._hashes != nullptr && other._hashes->enabled()
+                && hash() != other.hash()) return false;
+        return view() == other.view();
     }
     bool operator!=(const GenericRValue &other) const{
-        return *_value != *other._value;
+        return !(*this == other);
     }
+    /// 结构哈希，见RConstValue::hash()，所属文档开启哈希缓存时使用缓存
+    uint64_t hash() const { return view().hashValue(_own ? nullptr : _hashes); }
     GenericRValue& operator=(const GenericRValue &other) {
         if (this != &other && _allocator != nullptr) {
-            _value->CopyFrom(*other._value, *_allocator);
+            //来自其他分配器时，共享的key等常量字符串也必须拷贝
+            modified();
+            _value->CopyFrom(*other._value, *_allocator, other._allocator != _allocator);
         }
 
         return *this;
@@ -208,7 +1437,7 @@ public:
 
     //对象类型操作函数
     /// 判断是否存在key键
-    bool contains(const std::string &key) {
+    bool contains(const std::string &key) const {
         if (!_value->IsObject()) return false;
 
         return _value->HasMember(key.c_str());
@@ -217,6 +1446,7 @@ public:
     void remove(const std::string &key) {
         if (!_value->IsObject()) return;
 
+        modified();
         _value->RemoveMember(key.c_str());
     }
 
@@ -227,20 +1457,19 @@ public:
             return {};
         }
         if (_value->IsNull()) {
+            modified();
             _value->SetObject();
         }
         if (!_value->IsObject()) {
             printf("value is not an object!\n");
             return {};
         }
-        if (!_value->HasMember(key.c_str())) {
-            //必须拷贝key内容
-            rapidjson::Value lvalue(key.c_str(), key.size(), *_allocator);
-            _value->AddMember(lvalue, {}, *_allocator);
-        }
 
-        auto& v = (*_value)[key.c_str()];
-        return GenericRValue(&v, _allocator);
+        //key不存在时插入了新成员
+        auto count = _value->MemberCount();
+        auto& v = detail::member(*_value, key, *_allocator, _keys);
+        if (_value->MemberCount() != count) modified();
+        return GenericRValue(&v, _allocator, _keys, _hashes);
     }
 
     std::vector<std::string> keys() const {
@@ -258,8 +1487,15 @@ public:
         return result;
     }
 
+    /// 只读查找key键，不存在时不会插入新成员，可用于多线程并发读取
+    RConstValue find(const std::string &key) const { return view().find(key); }
+    /// 只读视图，不修改当前值
+    RConstValue view() const { return RConstValue(_value); }
+
     //数组类型操作函数
-    GenericRValue operator[](unsigned int i) const {
+    /// 返回可修改的元素，紧凑数组先转换为普通数组；只读访问使用at()或const重载，不会转换
+    GenericRValue operator[](unsigned int i) {
+        unpack();
         if (!_value->IsArray()) {
             printf("RValue is not an array\n");
             return {};
@@ -271,32 +1507,65 @@ public:
             return {};
         }
         auto& value = _value->GetArray()[i];
-        return GenericRValue(&value, _allocator);
+        return GenericRValue(&value, _allocator, _keys, _hashes);
     }
 
-    unsigned int size() const {
-        if (!_value->IsArray()) {
-            printf("RValue is not an array, no size!\n");
-            return 0;
-        }
-        return _value->Size();
+    /// 只读按照下标索引，越界时返回无效视图，紧凑数组不会被转换
+    RConstValue at(unsigned int i) const { return view().at(i); }
+    RConstValue operator[](unsigned int i) const { return at(i); }
+
+    /// 紧凑数组的元素类型，见RConstValue::packedType()
+    RPackedType packedType() const { return view().packedType(); }
+    /// 紧凑数组元素的连续内存，见RConstValue::span()
+    template<typename T>
+    RSpan<const T> span() const { return view().template span<T>(); }
+
+    /// 按列读取对象数组，见RConstValue::extractColumns()
+    bool extractColumns(const RColumns &columns, unsigned int threads = 1) const {
+        return view().extractColumns(columns, threads);
     }
 
-    void append(const GenericRValue& value) {
+    /// 按列构造对象并追加到数组末尾，紧凑数组先转换为普通数组
+    bool appendColumns(const RColumns &columns) {
         if (_value->IsNull())
             _value->SetArray();
         if (_allocator == nullptr) {
-            printf("RValue has not allocator, can not append!\n");
-            return;
+            printf("RValue has not allocator, can not append columns!\n");
+            return false;
         }
+        unpack();
         if (!_value->IsArray()) {
-            printf("RValue is not an array, can not append!\n");
-            return;
+            printf("RValue is not an array, can not append columns!\n");
+            return false;
         }
 
-        _value->PushBack(*value._value, *_allocator);
+        modified();
+        columns.appendTo(*_value, *_allocator, _keys);
+        return true;
+    }
+
+    unsigned int size() const {
+        if (!isArray()) {
+            printf("RValue is not an array, no size!\n");
+            return 0;
+        }
+        return view().size();
     }
 
+    /// 追加元素，紧凑数组追加同类型数字时直接写入连续内存，类型不同时先转换为普通数组
+    void append(const GenericRValue& value) { appendValue(*value._value); }
+
+    /**
+     * @brief append批量追加数字，空数组追加不少于4个数字时以紧凑数组保存，紧凑数组追加同类型数字时直接拷贝到连续内存。
+     * @code 典型用法
+     *      std::vector<double> samples = read();
+     *      doc["samples"].append(samples.data(), samples.size());
+     *      auto span = doc.find("samples").span<double>();
+     */
+    void append(const double *values, size_t count) { appendValues(values, count); }
+    void append(const int64_t *values, size_t count) { appendValues(values, count); }
+    void append(const int32_t *values, size_t count) { appendValues(values, count); }
+
     void append(const std::string& value) {
         GenericRValue v(value, _allocator);
         append(v);
@@ -313,41 +1582,43 @@ public:
     }
 
     void append(int value) {
-        GenericRValue v(value, _allocator);
-        append(v);
+        rapidjson::Value v(value);
+        appendValue(v);
     }
 
     void append(unsigned int value) {
-        GenericRValue v(value, _allocator);
-        append(v);
+        rapidjson::Value v(value);
+        appendValue(v);
     }
 
     void append(long long value) {
-        GenericRValue v(value, _allocator);
-        append(v);
+        rapidjson::Value v(static_cast<int64_t>(value));
+        appendValue(v);
     }
 
     void append(unsigned long long value) {
-        GenericRValue v(value, _allocator);
-        append(v);
+        rapidjson::Value v(static_cast<uint64_t>(value));
+        appendValue(v);
     }
 
     void append(double value) {
-        GenericRValue v(value, _allocator);
-        append(v);
+        rapidjson::Value v(value);
+        appendValue(v);
     }
 
     GenericRValue last() {
+        unpack();
         if (!_value->IsArray()) {
             printf("RValue is not an array, can not last!\n");
             return {};
         }
 
         auto iter = _value->End()-1;
-        return GenericRValue(&(*iter), _allocator);
+        return GenericRValue(&(*iter), _allocator, _keys, _hashes);
     }
 
     void remove(int i, int n = 1) {
+        unpack();
         if (!_value->IsArray()) {
             printf("RValue is not an array, can not remove!\n");
             return;
@@ -358,24 +1629,131 @@ public:
             return;
         }
 
+        modified();
         auto begin = _value->Begin()+i;
         auto end = begin+n;
         _value->Erase(begin, end);
     }
 
     void clear() {
+        modified();
+        if (detail::isPacked(*_value)) {
+            _value->SetArray();
+            return;
+        }
         _value->Clear();
     }
 
 private:
-    GenericRValue(rapidjson::Value* other, Allocator* alloc)
-        : _value(other), _allocator(alloc), _own(false) {
+    GenericRValue(rapidjson::Value* other, Allocator* alloc, detail::KeyPool* keys = nullptr, detail::HashCache* hashes = nullptr)
+        : _value(other), _allocator(alloc), _own(false), _keys(keys), _hashes(hashes) {
+    }
+
+    /// 值被修改，所属文档的哈希缓存失效
+    void modified() const {
+        if (_hashes != nullptr) _hashes->invalidate();
+    }
+
+    void setString(const char *s, size_t size) {
+        modified();
+        if (!detail::setString(*_value, s, size, *_allocator))
+            printf("RValue setValue error, string starts with invalid UTF-8 byte 0x%02X.\n", static_cast<unsigned char>(s[0]));
+    }
+
+    /// 紧凑数组转换为普通数组，没有分配器时保持不变
+    void unpack() const {
+        if (_allocator != nullptr)
+            detail::unpack(*_value, *_allocator);
+    }
+
+    /// 追加并移走value，数字直接写入同类型紧凑数组的连续内存
+    void appendValue(rapidjson::Value &value) {
+        if (_value->IsNull())
+            _value->SetArray();
+        if (_allocator == nullptr) {
+            printf("RValue has not allocator, can not append!\n");
+            return;
+        }
+        modified();
+        if (appendPacked(value)) return;
+        unpack();
+        if (!_value->IsArray()) {
+            printf("RValue is not an array, can not append!\n");
+            return;
+        }
+
+        _value->PushBack(value, *_allocator);
+    }
+
+    /// 紧凑数组追加同类型的数字，返回false表示需要按普通数组追加
+    bool appendPacked(const rapidjson::Value &value) {
+        switch (detail::packedType(*_value)) {
+        case kPackedInt32:
+            if (!value.IsInt()) return false;
+            {
+                int32_t v = value.GetInt();
+                detail::packedAppend(*_value, &v, 1, *_allocator);
+            }
+            return true;
+        case kPackedInt64:
+            if (!value.IsInt64()) return false;
+            {
+                int64_t v = value.GetInt64();
+                detail::packedAppend(*_value, &v, 1, *_allocator);
+            }
+            return true;
+        case kPackedDouble:
+            if (!value.IsDouble()) return false;
+            {
+                double v = value.GetDouble();
+                detail::packedAppend(*_value, &v, 1, *_allocator);
+            }
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    template<typename T>
+    void appendValues(const T *values, size_t count) {
+        if (_value->IsNull())
+            _value->SetArray();
+        if (_allocator == nullptr) {
+            printf("RValue has not allocator, can not append!\n");
+            return;
+        }
+
+        modified();
+        const RPackedType type = detail::PackedTypeOf<T>::value;
+        if (detail::packedType(*_value) == type) {
+            detail::packedAppend(*_value, values, count, *_allocator);
+            return;
+        }
+        if (_value->IsArray() && _value->Empty() && count >= detail::kPackedMinCount) {
+            detail::setPacked(*_value, type, values, count, count, *_allocator);
+            return;
+        }
+
+        unpack();
+        if (!_value->IsArray()) {
+            printf("RValue is not an array, can not append!\n");
+            return;
+        }
+        _value->Reserve(static_cast<rapidjson::SizeType>(_value->Size() + count), *_allocator);
+        for (size_t i = 0; i < count; ++i) {
+            rapidjson::Value v(values[i]);
+            _value->PushBack(v, *_allocator);
+        }
     }
 
 private:
     friend class RDocument;
     Allocator* _allocator = nullptr;
     rapidjson::Value* _value = nullptr;
+    /// 所属文档的key字典，为空时插入成员总是拷贝key
+    detail::KeyPool* _keys = nullptr;
+    /// 所属文档的哈希缓存，为空时不缓存
+    detail::HashCache* _hashes = nullptr;
 
     /// True时,析构函数释放_value指向对象;否则,不释放_value指向对象
     bool _own = true;
@@ -423,39 +1801,103 @@ public:
      */
     RDocument(const RValue &object) {
         if (object._value != nullptr)
-            _doc.CopyFrom(*(object._value), _doc.GetAllocator());
+            _doc.CopyFrom(*(object._value), _doc.GetAllocator(), true);
+        //根节点总是普通数组
+        detail::unpack(_doc, _doc.GetAllocator());
     }
 
-    RDocument(const RDocument &other) {
-        _doc.CopyFrom(other._doc, _doc.GetAllocator());
+    RDocument(const RDocument &other) : _result(other._result) {
+        if (other.keyInterning())
+            _keys.reset(new detail::KeyPool(&_doc.GetAllocator()));
+        if (other.hashCaching())
+            _hashes->setEnabled(true);
+        detail::copyValue(_doc, other._doc, _doc.GetAllocator(), keyPool());
     }
 
-    RDocument(RDocument &&other) : _doc(std::move(other._doc)) {}
+    RDocument(RDocument &&other)
+        : _arena(std::move(other._arena)), _doc(std::move(other._doc)), _result(other._result)
+        , _keys(std::move(other._keys)), _hashes(std::move(other._hashes)) {
+        //根节点的地址已经改变
+        modified();
+    }
 
     ~RDocument() {}
 
     bool isObject() const { return _doc.IsObject(); }
     bool isArray() const { return _doc.IsArray(); }
-    bool isNumber() const { return _doc.IsNumber(); }
-    bool isString() const { return _doc.IsString(); }
+    bool isNumber() const { return root().isNumber(); }
+    bool isString() const { return root().isString(); }
     bool isBool() const { return _doc.IsBool(); }
     bool isNull() const { return _doc.IsNull(); }
 
     RValue value() {
         RValue value(&_doc.GetAllocator());
         value._value->CopyFrom(_doc, _doc.GetAllocator());
+        value._keys = _keys.get();
+        value._hashes = _hashes.get();
+        return value;
+    }
+
+    /// 创建使用本文档分配器和key字典的空值，开启key共享时插入的成员名也会共享
+    RValue createValue() {
+        RValue value(&_doc.GetAllocator());
+        value._keys = _keys.get();
+        value._hashes = _hashes.get();
         return value;
     }
 
     void setValue(const RValue& v) {
-        _doc.CopyFrom(*v._value, _doc.GetAllocator());
+        modified();
+        _doc.CopyFrom(*v._value, _doc.GetAllocator(), v._allocator != &_doc.GetAllocator());
+        detail::unpack(_doc, _doc.GetAllocator());
+    }
+
+    /**
+     * @brief setKeyInterning开启或关闭key共享。
+     * 开启后解析和operator[]插入的成员名在文档内只保存一份，适合大量结构相同的对象，例如记录数组。
+     * 只有超过rapidjson短字符串长度(64位平台为13字节)的key会被共享，更短的key本身就保存在值内部。
+     * 关闭只影响之后插入的成员，已共享的key随文档分配器一起释放；已取得的RValue在关闭后仍然可以使用。
+     */
+    void setKeyInterning(bool enable) {
+        if (_keys != nullptr)
+            _keys->setEnabled(enable);
+        else if (enable)
+            _keys.reset(new detail::KeyPool(&_doc.GetAllocator()));
     }
+    bool keyInterning() const { return _keys != nullptr && _keys->enabled(); }
 
-    bool operator==(const RDocument &other) const { return _doc == other._doc; }
-    bool operator!=(const RDocument &other) const { return _doc != other._doc; }
+    /**
+     * @brief setHashCaching开启或关闭子树哈希缓存。
+     * 开启后hash()计算过的对象和数组的哈希值按节点保存，再次计算时直接返回；
+     * 通过RDocument或其RValue修改文档时缓存整体失效，即使只修改了一个叶子节点，下一次hash()也会重新计算整棵树，
+     * 适合反复比较或者作为缓存key的只读为主的大文档。开启前取得的RValue同样会使缓存失效。
+     * 缓存在计算哈希时写入，开启后不能在多个线程中同时调用hash()或operator==。
+     * 关闭时释放已缓存的哈希值，已取得的RValue在关闭后仍然可以使用。
+     */
+    void setHashCaching(bool enable) {
+        if (_hashes != nullptr)
+            _hashes->setEnabled(enable);
+        else if (enable)
+            _hashes.reset(new detail::HashCache());
+    }
+    bool hashCaching() const { return _hashes != nullptr && _hashes->enabled(); }
+
+    /// 结构哈希，见RConstValue::hash()
+    uint64_t hash() const { return root().hashValue(_hashes.get()); }
+
+    /// 按值比较，两边都开启哈希缓存时先比较哈希值，不同则直接返回false
+    bool operator==(const RDocument &other) const {
+        if (hashCaching() && other.hashCaching() && hash() != other.hash()) return false;
+        return root() == other.root();
+    }
+    bool operator!=(const RDocument &other) const { return !(*this == other); }
     RDocument& operator=(const RDocument &other) {
         if (this != &other) {
-            _doc.CopyFrom(other._doc, _doc.GetAllocator());
+            modified();
+            if (other.keyInterning())
+                setKeyInterning(true);
+            detail::copyValue(_doc, other._doc, _doc.GetAllocator(), keyPool());
+            _result = other._result;
         }
 
         return *this;
@@ -464,12 +1906,18 @@ public:
     RDocument& operator=(RDocument &&other) {
         if (this != &other) {
             _doc = std::move(other._doc);
+            //旧的分配器已不再被_doc使用
+            _arena = std::move(other._arena);
+            _result = other._result;
+            _keys = std::move(other._keys);
+            _hashes = std::move(other._hashes);
+            modified();
         }
 
         return *this;
     }
 
-    bool contains(const std::string &key) {
+    bool contains(const std::string &key) const {
         if (!_doc.IsObject()) return false;
 
         return _doc.HasMember(key.c_str());
@@ -478,6 +1926,7 @@ public:
     void remove(const std::string &key) {
         if (!_doc.IsObject()) return;
 
+        modified();
         _doc.RemoveMember(key.c_str());
     }
 
@@ -496,22 +1945,47 @@ public:
         return result;
     }
 
-    RValue operator[](const std::string &key) const {
+    /// 只读视图，不修改文档，多个线程可同时读取
+    RConstValue root() const { return RConstValue(&_doc); }
+    /// 只读查找key键，不存在时返回无效视图，不会像operator[]那样插入新成员
+    RConstValue find(const std::string &key) const { return root().find(key); }
+    /// 只读按照下标索引，越界时返回无效视图
+    RConstValue at(unsigned int i) const { return root().at(i); }
+
+    /// 按列读取对象数组，见RConstValue::extractColumns()
+    bool extractColumns(const RColumns &columns, unsigned int threads = 1) const {
+        return root().extractColumns(columns, threads);
+    }
+
+    /// 按列构造对象并追加到数组末尾
+    bool appendColumns(const RColumns &columns) {
         if (_doc.IsNull())
+            _doc.SetArray();
+        if (!_doc.IsArray()) {
+            printf("RDocument is not an array, can not append columns!\n");
+            return false;
+        }
+
+        modified();
+        columns.appendTo(_doc, _doc.GetAllocator(), _keys.get());
+        return true;
+    }
+
+    RValue operator[](const std::string &key) const {
+        if (_doc.IsNull()) {
+            modified();
             _doc.SetObject();
+        }
         if (!_doc.IsObject()) {
             printf("RDocument is not an object\n");
             return RValue(&_doc.GetAllocator());
         }
 
-        if (!_doc.HasMember(key.c_str())) {
-            //必须拷贝key内容
-            rapidjson::Value lvalue(key.c_str(), key.size(), _doc.GetAllocator());
-            _doc.AddMember(lvalue, {}, _doc.GetAllocator());
-        }
-
-        auto& value = _doc[key.c_str()];
-        return RValue(&value, &_doc.GetAllocator());
+        //key不存在时插入了新成员
+        auto count = _doc.MemberCount();
+        auto& value = detail::member(_doc, key, _doc.GetAllocator(), _keys.get());
+        if (_doc.MemberCount() != count) modified();
+        return RValue(&value, &_doc.GetAllocator(), _keys.get(), _hashes.get());
     }
 
     RValue operator[](unsigned int i) const {
@@ -526,7 +2000,7 @@ public:
             return {};
         }
         auto& value = _doc[i];
-        return RValue(&value, &_doc.GetAllocator());
+        return RValue(&value, &_doc.GetAllocator(), _keys.get(), _hashes.get());
     }
 
     int size() const {
@@ -545,6 +2019,7 @@ public:
             return;
         }
 
+        modified();
         _doc.PushBack(*value._value, _doc.GetAllocator());
     }
 
@@ -595,7 +2070,7 @@ public:
         }
 
         auto iter = _doc.End()-1;
-        return RValue(&(*iter), &_doc.GetAllocator());
+        return RValue(&(*iter), &_doc.GetAllocator(), _keys.get(), _hashes.get());
     }
 
     void remove(unsigned int i, unsigned int n) {
@@ -609,20 +2084,80 @@ public:
             return;
         }
 
+        modified();
         auto begin = _doc.Begin()+i;
         auto end = begin+n;
         _doc.Erase(begin, end);
     }
 
     void clear() {
+        modified();
         _doc.Clear();
     }
 
+    /**
+     * @brief reset清空文档并释放全部节点占用的内存，文档对象和rapidjson的解析栈保留，适合反复解析的场景。
+     * 之前取得的RValue、RConstValue全部失效。
+     */
+    void reset() {
+        modified();
+        _doc.SetNull();
+        _doc.GetAllocator().Clear();
+        //共享的key保存在分配器中，需要重建
+        if (_keys != nullptr) {
+            bool enabled = _keys->enabled();
+            _keys.reset(new detail::KeyPool(&_doc.GetAllocator()));
+            _keys->setEnabled(enabled);
+        }
+        _result.Clear();
+    }
+
+    /**
+     * @brief compact把存活的节点拷贝到按实际大小申请的内存中，并释放旧的分配器。
+     * MemoryPoolAllocator不回收内存，remove、覆盖赋值、setValue和clear之后旧节点仍然占用空间，
+     * 长期修改的文档可以定期调用compact()，使内存与存活数据成正比。
+     * 整理后之前取得的RValue、RConstValue、createValue()创建的值以及allocator()返回的指针全部失效。
+     * @param wasteRatio 浪费比例阈值，(已分配-存活)/已分配小于该值时不整理，0表示总是整理
+     * @return 释放的字节数，未整理时返回0
+     */
+    size_t compact(double wasteRatio = 0) {
+        size_t before = _doc.GetAllocator().Capacity();
+        std::unordered_set<const char*> interned;
+        size_t live = detail::liveBytes(_doc, keyInterning() ? &interned : nullptr);
+        size_t waste = before > live ? before - live : 0;
+        if (before == 0 || static_cast<double>(waste) / before < wasteRatio) return 0;
+
+        //节点地址全部改变
+        modified();
+        std::unique_ptr<detail::Arena> arena(new detail::Arena(live));
+        std::unique_ptr<detail::KeyPool> keys;
+        if (_keys != nullptr) {
+            keys.reset(new detail::KeyPool(&arena->allocator));
+            keys->setEnabled(_keys->enabled());
+        }
+        {
+            rapidjson::Document fresh(&arena->allocator);
+            detail::copyValue(fresh, _doc, arena->allocator, keyInterning() ? keys.get() : nullptr);
+            //交换后fresh持有旧分配器，离开作用域时释放
+            _doc.Swap(fresh);
+        }
+        _arena = std::move(arena);
+        _keys = std::move(keys);
+
+        size_t after = _doc.GetAllocator().Capacity();
+        return before > after ? before - after : 0;
+    }
+
+    /// 分配器已申请的字节数，包括已删除节点占用的空间
+    size_t memoryUsage() const { return _doc.GetAllocator().Capacity(); }
+
+    /// 生成JSON字符串，延迟解码的数字原样输出；包含NaN、Inf时需要writeFlags指定rapidjson::kWriteNanAndInfFlag
+    template<unsigned writeFlags = rapidjson::kWriteDefaultFlags>
     std::string toJson() const {
         rapidjson::StringBuffer buffer;
-        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-        _doc.Accept(writer);
-        return buffer.GetString();
+        detail::JsonWriter<rapidjson::StringBuffer, writeFlags> writer(buffer);
+        root().accept(writer);
+        return std::string(buffer.GetString(), buffer.GetSize());
     }
 
     /// 由于Rapidjson使用要求,RDocument类提供分配器获取接口,保证内存高效分配及统一释放
@@ -631,16 +2166,132 @@ public:
         return &_doc.GetAllocator();
     }
 
+    /**
+     * @brief parse解析data并替换当前内容，解析失败时保持原内容不变。
+     * @param parseFlags为RParseFlag组合，例如kParseComments | kParseLazyNumbers
+     * @return 是否解析成功，失败原因见parseError()和errorOffset()
+     */
+    template<unsigned parseFlags = kParseDefault>
+    bool parse(const char* data, size_t size) {
+        static const unsigned flags = parseFlags & ~static_cast<unsigned>(kParseLazyNumbers | kParseInternKeys | kParsePackArrays);
+        if ((parseFlags & kParseInternKeys) != 0)
+            setKeyInterning(true);
+        modified();
+        //总是经过DocumentHandler，拒绝以内部标记字节开头的字符串
+        rapidjson::Reader reader;
+        rapidjson::MemoryStream stream(data, size);
+        auto generator = [&](rapidjson::Document &doc) {
+            detail::DocumentHandler handler(doc, _keys.get(), (parseFlags & kParsePackArrays) != 0);
+            _result = handler.result(reader.Parse<flags | (parseFlags & kParseLazyNumbers ? rapidjson::kParseNumbersAsStringsFlag : 0)>(stream, handler));
+            return !_result.IsError();
+        };
+        _doc.Populate(generator);
+        return !_result.IsError();
+    }
+
+    //最近一次解析的结果
+    bool hasParseError() const { return _result.IsError(); }
+    rapidjson::ParseErrorCode parseError() const { return _result.Code(); }
+    size_t errorOffset() const { return _result.Offset(); }
+    std::string parseErrorString() const { return rapidjson::GetParseError_En(_result.Code()); }
+
 public:
+    template<unsigned parseFlags = kParseDefault>
     static RDocument fromJson(const char* data, size_t size) {
         RDocument d;
-        d._doc.Parse(data, size);
+        d.parse<parseFlags>(data, size);
         return d;
     }
 
 private:
+    friend class RSchema;
+    friend class RSnapshot;
+    template<unsigned> friend class GenericRPushParser;
+
+    /// 开启key共享时返回key字典，否则返回nullptr
+    detail::KeyPool* keyPool() const { return keyInterning() ? _keys.get() : nullptr; }
+
+    /// 文档被修改，哈希缓存失效
+    void modified() const {
+        if (_hashes != nullptr) _hashes->invalidate();
+    }
+
+    /// compact()之后_doc使用的分配器，必须在_doc之后析构
+    std::unique_ptr<detail::Arena> _arena;
     mutable rapidjson::Document _doc;
+    rapidjson::ParseResult _result;
+    std::unique_ptr<detail::KeyPool> _keys;
+    /// 总是存在，默认关闭，开启前取得的RValue也持有有效指针；只有被移走的文档为空
+    std::unique_ptr<detail::HashCache> _hashes{new detail::HashCache()};
 };
+
+/**
+ * @brief RFrozenDocument类是只读的JSON文档，只提供不修改文档的访问接口。
+ * 构造完成后文档内容不再变化，多个线程可以无锁地同时查询同一个RFrozenDocument，
+ * 通常用std::shared_ptr在线程间共享。
+ * @code 典型用法
+ *      auto frozen = std::make_shared<RFrozenDocument>(RDocument::fromJson(txt.c_str(), txt.size()));
+ *      //任意线程中
+ *      auto age = frozen->find("names").at(0).find("age").toInt();
+ */
+class RFrozenDocument {
+public:
+    explicit RFrozenDocument(RDocument &&doc) : _doc(std::move(doc)) {}
+    RFrozenDocument(RFrozenDocument &&other) : _doc(std::move(other._doc)) {}
+    RFrozenDocument(const RFrozenDocument &) = delete;
+    RFrozenDocument& operator=(const RFrozenDocument &) = delete;
+
+    bool isObject() const { return _doc.isObject(); }
+    bool isArray() const { return _doc.isArray(); }
+    bool isNull() const { return _doc.isNull(); }
+
+    RConstValue root() const { return _doc.root(); }
+    RConstValue find(const std::string &key) const { return _doc.find(key); }
+    RConstValue at(unsigned int i) const { return _doc.at(i); }
+    bool contains(const std::string &key) const { return _doc.contains(key); }
+    unsigned int size() const { return root().size(); }
+    std::vector<std::string> keys() const { return root().keys(); }
+
+    std::string toJson() const { return _doc.toJson(); }
+
+    /// 结构哈希，不使用缓存，可在多个线程中同时调用
+    uint64_t hash() const { return root().hash(); }
+    bool operator==(const RFrozenDocument &other) const { return root() == other.root(); }
+    bool operator!=(const RFrozenDocument &other) const { return !(*this == other); }
+
+    /// 解冻，返回可修改的文档拷贝
+    RDocument thaw() const { return RDocument(_doc); }
+
+public:
+    static RFrozenDocument fromJson(const char* data, size_t size) {
+        return RFrozenDocument(RDocument::fromJson(data, size));
+    }
+
+private:
+    RDocument _doc;
+};
+
+/**
+ * @brief RHash是结构哈希函数对象，文档或子树可以作为std::unordered_map、std::unordered_set的key，用于去重和缓存。
+ * 相等的值哈希相同，与对象成员顺序无关。RDocument开启setHashCaching()后重复计算直接命中缓存。
+ * @code 典型用法
+ *      std::unordered_map<RDocument, Result, RHash> results;
+ *      std::unordered_set<RConstValue, RHash> seen;
+ *      for (unsigned int i = 0; i < doc.size(); ++i)
+ *          if (!seen.insert(doc.at(i)).second) printf("duplicate:%u\n", i);
+ */
+struct RHash {
+    size_t operator()(const RDocument &doc) const { return static_cast<size_t>(doc.hash()); }
+    size_t operator()(const RFrozenDocument &doc) const { return static_cast<size_t>(doc.hash()); }
+    size_t operator()(const RConstValue &value) const { return static_cast<size_t>(value.hash()); }
+    template<typename Allocator>
+    size_t operator()(const GenericRValue<Allocator> &value) const { return static_cast<size_t>(value.hash()); }
+};
+}
+
+namespace std {
+template<> struct hash<RJson::RDocument> : RJson::RHash {};
+template<> struct hash<RJson::RConstValue> : RJson::RHash {};
 }
 
 #endif// __RJson_H__
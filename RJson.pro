@@ -1,5 +1,5 @@
 
-CONFIG += c++11 console
+CONFIG += c++11 console thread
 CONFIG -= qt app_bundle
 
 # The following define makes your compiler emit warnings if you use
@@ -15,6 +15,13 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 DEFINES += RAPIDJSON_HAS_CXX11_RVALUE_REFS
 INCLUDEPATH += $$PWD/rapidjson/include
+HEADERS += \
+        RJson.h \
+        RPipeline.h \
+        RPushParser.h \
+        RSchema.h \
+        RSnapshot.h
+
 SOURCES += \
         main.cpp
 
@@ -0,0 +1,581 @@
+/****************************************************************************
+** Copyright (C) 2021. All rights reserved.
+**
+** Licensed under the MIT License (the "License"); you may not use this file except
+** in compliance with the License. You may obtain a copy of the License at
+**
+** http://opensource.org/licenses/MIT
+**
+** Unless required by applicable law or agreed to in writing, software distributed
+** under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+** CONDITIONS OF ANY KIND, either express or implied. See the License for the
+** specific language governing permissions and limitations under the License.
+****************************************************************************/
+#ifndef __RPipeline_H__
+#define __RPipeline_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RJson.h"
+
+namespace RJson {
+/// 记录流格式
+enum RRecordFormat {
+    kRecordLines,   ///< NDJSON，每行一条记录，空行忽略
+    kRecordArray    ///< 顶层数组，每个元素一条记录
+};
+
+/// 单个阶段的统计
+struct RStageStats {
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    /// 处理耗时(秒)，不包括等待队列的时间
+    double busySeconds = 0;
+    /// 等待上游数据或下游空位的时间(秒)，占比高说明瓶颈在其他阶段
+    double waitSeconds = 0;
+
+    /// 处理吞吐，每秒记录数
+    double recordsPerSecond() const { return busySeconds > 0 ? records / busySeconds : 0; }
+    /// 处理吞吐，每秒MB
+    double megabytesPerSecond() const { return busySeconds > 0 ? bytes / busySeconds / (1024.0 * 1024.0) : 0; }
+};
+
+/// 阶段之间队列的统计，深度以批为单位，每次入队时采样；长期接近容量说明下游是瓶颈，接近0说明上游是瓶颈
+struct RQueueStats {
+    size_t capacity = 0;
+    size_t maxDepth = 0;
+    double averageDepth = 0;
+};
+
+/// RPipeline一次运行的统计
+struct RPipelineStats {
+    RStageStats read, parse, transform, write;
+    /// 读取→解析、解析→转换、转换→写入三个队列
+    RQueueStats parseQueue, transformQueue, writeQueue;
+    /// 解析失败被跳过的记录数
+    uint64_t parseErrors = 0;
+    /// 序列化失败被跳过的记录数，例如默认writeFlags下的NaN、Inf
+    uint64_t writeErrors = 0;
+    /// transform返回false被丢弃的记录数
+    uint64_t dropped = 0;
+    /// 总耗时(秒)
+    double seconds = 0;
+
+    std::string toString() const {
+        std::string text;
+        char line[160];
+        auto stage = [&](const char *name, const RStageStats &s) {
+            snprintf(line, sizeof(line), "%-9s records:%llu bytes:%llu busy:%.3fs wait:%.3fs %.0f records/s %.1f MB/s\n",
+                     name, (unsigned long long)s.records, (unsigned long long)s.bytes, s.busySeconds, s.waitSeconds,
+                     s.recordsPerSecond(), s.megabytesPerSecond());
+            text += line;
+        };
+        auto queue = [&](const char *name, const RQueueStats &q) {
+            snprintf(line, sizeof(line), "%-9s capacity:%u max:%u average:%.2f\n",
+                     name, (unsigned int)q.capacity, (unsigned int)q.maxDepth, q.averageDepth);
+            text += line;
+        };
+        stage("read", read);
+        queue("->parse", parseQueue);
+        stage("parse", parse);
+        queue("->trans", transformQueue);
+        stage("transform", transform);
+        queue("->write", writeQueue);
+        stage("write", write);
+        snprintf(line, sizeof(line), "total %.3fs, parse errors:%llu, write errors:%llu, dropped:%llu\n",
+                 seconds, (unsigned long long)parseErrors, (unsigned long long)writeErrors, (unsigned long long)dropped);
+        text += line;
+        return text;
+    }
+};
+
+namespace detail {
+/// 有界阻塞队列，满时push阻塞，上游被迫等待下游，形成背压
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : _capacity(capacity > 0 ? capacity : 1) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notFull.wait(lock, [this] { return _items.size() < _capacity; });
+        _items.push_back(std::move(item));
+        ++_pushes;
+        _depthSum += _items.size();
+        if (_items.size() > _maxDepth)
+            _maxDepth = _items.size();
+        _notEmpty.notify_one();
+    }
+
+    /// 队列为空时阻塞，队列关闭并且取空后返回false
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmpty.wait(lock, [this] { return !_items.empty() || _closed; });
+        if (_items.empty()) return false;
+        item = std::move(_items.front());
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+
+    /// 上游结束，下游取空后退出
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _notEmpty.notify_all();
+    }
+
+    RQueueStats stats() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        RQueueStats s;
+        s.capacity = _capacity;
+        s.maxDepth = _maxDepth;
+        s.averageDepth = _pushes > 0 ? double(_depthSum) / _pushes : 0;
+        return s;
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::condition_variable _notEmpty, _notFull;
+    std::deque<T> _items;
+    size_t _capacity;
+    bool _closed = false;
+    uint64_t _pushes = 0, _depthSum = 0;
+    size_t _maxDepth = 0;
+};
+
+/// 在阶段之间流转的一批记录，字符串和文档在批之间复用，避免每条记录重新申请内存
+struct RecordBatch {
+    std::vector<std::string> texts;
+    std::vector<RDocument> docs;
+    std::vector<char> keep;
+    size_t count = 0;
+
+    void reset() {
+        count = 0;
+        if (!texts.empty())
+            texts[0].clear();
+    }
+
+    /// 正在读取的记录
+    std::string& current() {
+        if (texts.size() <= count)
+            texts.resize(count + 1);
+        return texts[count];
+    }
+
+    /// 当前记录读取完成，开始下一条
+    void commit() {
+        ++count;
+        if (count < texts.size())
+            texts[count].clear();
+    }
+};
+
+/// 把任意分块的输入切分为记录，只跟踪括号深度和字符串状态，不解析内容
+class RecordSplitter {
+public:
+    explicit RecordSplitter(RRecordFormat format) : _format(format) {}
+
+    /**
+     * @brief next从[p, end)中取出字符追加到record
+     * @return 一条记录完整时返回true，p指向记录之后；输入用完时返回false，不完整的内容保留在record中
+     */
+    bool next(const char *&p, const char *end, std::string &record) {
+        const char *start = p;
+        bool done = _format == kRecordLines ? nextLine(p, end, record) : nextElement(p, end, record);
+        _offset += p - start;
+        return done;
+    }
+
+    /// 输入结束，record中剩余内容构成最后一条记录时返回true
+    bool finish(std::string &record) {
+        if (_format == kRecordLines)
+            return !isBlank(record);
+        if (_state != kEnd)
+            _error = _state == kStart ? "expect '['" : "unterminated array";
+        return false;
+    }
+
+    bool hasError() const { return _error != nullptr; }
+    const char* error() const { return _error; }
+    size_t offset() const { return _offset; }
+
+private:
+    enum State { kStart, kBetween, kElement, kEnd };
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+    static bool isBlank(const std::string &s) {
+        for (char c : s)
+            if (!isSpace(c)) return false;
+        return true;
+    }
+
+    bool nextLine(const char *&p, const char *end, std::string &record) {
+        while (p < end) {
+            const char *newline = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (newline == nullptr) {
+                record.append(p, end);
+                p = end;
+                return false;
+            }
+            record.append(p, newline);
+            p = newline + 1;
+            if (isBlank(record)) {
+                record.clear();
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool nextElement(const char *&p, const char *end, std::string &record) {
+        while (p < end && _state != kElement) {
+            char c = *p;
+            if (isSpace(c)) {
+                ++p;
+            } else if (_state == kStart && c == '[') {
+                _state = kBetween;
+                ++p;
+            } else if (_state == kBetween && c == ']') {
+                _state = kEnd;
+                ++p;
+            } else if (_state == kBetween) {
+                _state = kElement;
+                _depth = 0;
+            } else {
+                if (_error == nullptr)
+                    _error = _state == kStart ? "expect '['" : "unexpected content after array";
+                p = end;
+                return false;
+            }
+        }
+
+        const char *begin = p;
+        for (; p < end; ++p) {
+            char c = *p;
+            if (_inString) {
+                if (_escape) _escape = false;
+                else if (c == '\\') _escape = true;
+                else if (c == '"') _inString = false;
+            } else if (c == '"') {
+                _inString = true;
+            } else if (c == '[' || c == '{') {
+                ++_depth;
+            } else if ((c == ',' || c == ']') && _depth == 0) {
+                record.append(begin, p);
+                _state = c == ',' ? kBetween : kEnd;
+                ++p;
+                return true;
+            } else if (c == ']' || c == '}') {
+                if (_depth > 0) --_depth;
+            }
+        }
+        record.append(begin, p);
+        return false;
+    }
+
+    RRecordFormat _format;
+    State _state = kStart;
+    unsigned int _depth = 0;
+    bool _inString = false;
+    bool _escape = false;
+    size_t _offset = 0;
+    const char *_error = nullptr;
+};
+}
+
+/**
+ * @brief GenericRPipeline按记录转换JSON文件，读取、解析、转换、序列化写入四个阶段各占一个线程，
+ * 阶段之间通过有界队列按批传递记录。队列满时上游阻塞，内存占用由批大小和队列容量决定，与文件大小无关。
+ * 批在阶段之间循环使用，记录字符串、RDocument和输出缓冲在批之间复用。
+ * 记录按输入顺序输出；解析或序列化失败的记录跳过并计数，transform返回false的记录丢弃。
+ * writeFlags默认由parseFlags推导，kParseNanAndInf解析的NaN、Inf按kWriteNanAndInfFlag原样写出。
+ * stats()给出各阶段的吞吐和队列深度，用于调整批大小和队列容量。
+ * @code 典型用法
+ *      RPipeline pipeline;
+ *      pipeline.setInputFormat(kRecordArray).setBatchSize(512);
+ *      pipeline.run("in.json", "out.ndjson", [](RDocument &doc) {
+ *          doc["checked"] = true;
+ *          return doc.contains("id");
+ *      });
+ *      printf("%s", pipeline.stats().toString().c_str());
+ */
+template<unsigned parseFlags = kParseDefault,
+         unsigned writeFlags = (parseFlags & kParseNanAndInf) != 0 ? rapidjson::kWriteNanAndInfFlag : rapidjson::kWriteDefaultFlags>
+class GenericRPipeline {
+    typedef std::chrono::steady_clock Clock;
+    typedef detail::BoundedQueue<detail::RecordBatch*> Queue;
+
+public:
+    /// 修改记录，返回false时丢弃该记录；只在转换线程中调用
+    typedef std::function<bool(RDocument &doc)> Transform;
+
+    GenericRPipeline() = default;
+    GenericRPipeline(const GenericRPipeline &) = delete;
+    GenericRPipeline& operator=(const GenericRPipeline &) = delete;
+
+    GenericRPipeline& setInputFormat(RRecordFormat format) { _inputFormat = format; return *this; }
+    GenericRPipeline& setOutputFormat(RRecordFormat format) { _outputFormat = format; return *this; }
+    /// 每批记录数，默认256
+    GenericRPipeline& setBatchSize(size_t records) { _batchSize = records > 0 ? records : 1; return *this; }
+    /// 每个队列最多缓存的批数，默认4
+    GenericRPipeline& setQueueCapacity(size_t batches) { _queueCapacity = batches > 0 ? batches : 1; return *this; }
+    /// 每次读取文件的字节数，默认1M
+    GenericRPipeline& setReadBufferSize(size_t bytes) { _readBufferSize = bytes > 0 ? bytes : 1; return *this; }
+
+    /**
+     * @brief run读取input中的记录，经transform处理后写入output，所有记录处理完成后返回
+     * @param transform 为空时只做格式转换
+     * @return 读写文件出错或输入格式错误时返回false，解析失败的记录不影响返回值
+     */
+    bool run(const std::string &input, const std::string &output, Transform transform = Transform()) {
+        _stats = RPipelineStats();
+        _failed = false;
+
+        FILE *in = fopen(input.c_str(), "rb");
+        if (in == nullptr) {
+            printf("RPipeline open error, file:%s.\n", input.c_str());
+            return false;
+        }
+        FILE *out = fopen(output.c_str(), "wb");
+        if (out == nullptr) {
+            printf("RPipeline open error, file:%s.\n", output.c_str());
+            fclose(in);
+            return false;
+        }
+
+        //三个队列都满载时，四个阶段各自还持有一批
+        const size_t batchCount = _queueCapacity * 3 + 4;
+        std::vector<std::unique_ptr<detail::RecordBatch>> batches;
+        Queue free(batchCount), toParse(_queueCapacity), toTransform(_queueCapacity), toWrite(_queueCapacity);
+        for (size_t i = 0; i < batchCount; ++i) {
+            batches.emplace_back(new detail::RecordBatch);
+            free.push(batches.back().get());
+        }
+
+        auto begin = Clock::now();
+        std::thread reader([&] { readStage(in, free, toParse); });
+        std::thread parser([&] { parseStage(toParse, toTransform); });
+        std::thread transformer([&] { transformStage(transform, toTransform, toWrite); });
+        std::thread writer([&] { writeStage(out, toWrite, free); });
+        reader.join();
+        parser.join();
+        transformer.join();
+        writer.join();
+        _stats.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        _stats.parseQueue = toParse.stats();
+        _stats.transformQueue = toTransform.stats();
+        _stats.writeQueue = toWrite.stats();
+        fclose(in);
+        if (fclose(out) != 0 && !_failed) {
+            printf("RPipeline write error, file:%s.\n", output.c_str());
+            _failed = true;
+        }
+        return !_failed;
+    }
+
+    /// 最近一次run的统计
+    const RPipelineStats& stats() const { return _stats; }
+
+private:
+    /// 返回距上次计时的秒数，并重新开始计时
+    static double lap(Clock::time_point &t) {
+        auto now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - t).count();
+        t = now;
+        return seconds;
+    }
+
+    void readStage(FILE *in, Queue &free, Queue &output) {
+        RStageStats &stats = _stats.read;
+        detail::RecordSplitter splitter(_inputFormat);
+        std::vector<char> buffer(_readBufferSize);
+        detail::RecordBatch *batch = nullptr;
+        auto t = Clock::now();
+        free.pop(batch);
+        batch->reset();
+        stats.waitSeconds += lap(t);
+
+        bool first = true;
+        while (!_failed) {
+            size_t n = fread(buffer.data(), 1, buffer.size(), in);
+            if (n == 0) break;
+            stats.bytes += n;
+            const char *p = buffer.data(), *end = p + n;
+            //跳过UTF8 BOM
+            if (first && n >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+                p += 3;
+            first = false;
+
+            while (p < end && splitter.next(p, end, batch->current())) {
+                batch->commit();
+                ++stats.records;
+                if (batch->count == _batchSize) {
+                    stats.busySeconds += lap(t);
+                    output.push(batch);
+                    free.pop(batch);
+                    batch->reset();
+                    stats.waitSeconds += lap(t);
+                }
+            }
+            if (splitter.hasError()) break;
+        }
+
+        if (ferror(in)) {
+            printf("RPipeline read error.\n");
+            _failed = true;
+        } else if (splitter.finish(batch->current())) {
+            batch->commit();
+            ++stats.records;
+        }
+        if (splitter.hasError()) {
+            printf("RPipeline read error, %s, offset:%u.\n", splitter.error(), (unsigned int)splitter.offset());
+            _failed = true;
+        }
+        stats.busySeconds += lap(t);
+
+        if (batch->count > 0)
+            output.push(batch);
+        else
+            free.push(batch);
+        output.close();
+        stats.waitSeconds += lap(t);
+    }
+
+    void parseStage(Queue &input, Queue &output) {
+        RStageStats &stats = _stats.parse;
+        detail::RecordBatch *batch = nullptr;
+        auto t = Clock::now();
+        while (input.pop(batch)) {
+            stats.waitSeconds += lap(t);
+            if (batch->docs.size() < batch->count) {
+                batch->docs.resize(batch->count);
+                batch->keep.resize(batch->count);
+            }
+            for (size_t i = 0; i < batch->count; ++i) {
+                const std::string &text = batch->texts[i];
+                RDocument &doc = batch->docs[i];
+                //复用文档对象，先释放上一条记录的节点，内存占用不随记录数增长
+                doc.reset();
+                batch->keep[i] = doc.parse<parseFlags>(text.data(), text.size());
+                if (!batch->keep[i]) {
+                    printf("RPipeline parse error, record:%llu, %s, offset:%u.\n",
+                           (unsigned long long)(stats.records + i), doc.parseErrorString().c_str(), (unsigned int)doc.errorOffset());
+                    ++_stats.parseErrors;
+                }
+                stats.bytes += text.size();
+            }
+            stats.records += batch->count;
+            stats.busySeconds += lap(t);
+            output.push(batch);
+            stats.waitSeconds += lap(t);
+        }
+        output.close();
+        stats.waitSeconds += lap(t);
+    }
+
+    void transformStage(const Transform &transform, Queue &input, Queue &output) {
+        RStageStats &stats = _stats.transform;
+        detail::RecordBatch *batch = nullptr;
+        auto t = Clock::now();
+        while (input.pop(batch)) {
+            stats.waitSeconds += lap(t);
+            for (size_t i = 0; i < batch->count; ++i) {
+                if (!batch->keep[i]) continue;
+                ++stats.records;
+                if (transform && !transform(batch->docs[i])) {
+                    batch->keep[i] = false;
+                    ++_stats.dropped;
+                }
+            }
+            stats.busySeconds += lap(t);
+            output.push(batch);
+            stats.waitSeconds += lap(t);
+        }
+        output.close();
+        stats.waitSeconds += lap(t);
+    }
+
+    void writeStage(FILE *out, Queue &input, Queue &free) {
+        RStageStats &stats = _stats.write;
+        rapidjson::StringBuffer buffer;
+        detail::JsonWriter<rapidjson::StringBuffer, writeFlags> writer(buffer);
+        detail::RecordBatch *batch = nullptr;
+        bool array = _outputFormat == kRecordArray;
+        bool first = true;
+        auto t = Clock::now();
+        if (array) buffer.Put('[');
+
+        while (input.pop(batch)) {
+            stats.waitSeconds += lap(t);
+            for (size_t i = 0; i < batch->count; ++i) {
+                if (!batch->keep[i]) continue;
+                const size_t start = buffer.GetSize();
+                if (array) {
+                    if (!first) buffer.Put(',');
+                    buffer.Put('\n');
+                }
+                writer.Reset(buffer);
+                if (!batch->docs[i].root().accept(writer)) {
+                    //去掉已写出的部分记录
+                    buffer.Pop(buffer.GetSize() - start);
+                    printf("RPipeline write error, record:%llu.\n", (unsigned long long)(stats.records + _stats.writeErrors));
+                    ++_stats.writeErrors;
+                    continue;
+                }
+                first = false;
+                if (!array) buffer.Put('\n');
+                ++stats.records;
+            }
+            flush(out, buffer);
+            stats.busySeconds += lap(t);
+            //写入失败后继续回收批，上游才能结束
+            free.push(batch);
+            stats.waitSeconds += lap(t);
+        }
+
+        if (array) {
+            if (!first) buffer.Put('\n');
+            buffer.Put(']');
+            buffer.Put('\n');
+            flush(out, buffer);
+        }
+        stats.busySeconds += lap(t);
+    }
+
+    void flush(FILE *out, rapidjson::StringBuffer &buffer) {
+        if (!_failed && fwrite(buffer.GetString(), 1, buffer.GetSize(), out) != buffer.GetSize()) {
+            printf("RPipeline write error.\n");
+            _failed = true;
+        }
+        _stats.write.bytes += buffer.GetSize();
+        buffer.Clear();
+    }
+
+    RRecordFormat _inputFormat = kRecordLines;
+    RRecordFormat _outputFormat = kRecordLines;
+    size_t _batchSize = 256;
+    size_t _queueCapacity = 4;
+    size_t _readBufferSize = 1 << 20;
+    std::atomic<bool> _failed{false};
+    RPipelineStats _stats;
+};
+
+using RPipeline = GenericRPipeline<>;
+}
+
+#endif// __RPipeline_H__
@@ -0,0 +1,615 @@
+/****************************************************************************
+** Copyright (C) 2021. All rights reserved.
+**
+** Licensed under the MIT License (the "License"); you may not use this file except
+** in compliance with the License. You may obtain a copy of the License at
+**
+** http://opensource.org/licenses/MIT
+**
+** Unless required by applicable law or agreed to in writing, software distributed
+** under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+** CONDITIONS OF ANY KIND, either express or implied. See the License for the
+** specific language governing permissions and limitations under the License.
+****************************************************************************/
+#ifndef __RPushParser_H__
+#define __RPushParser_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "RJson.h"
+
+namespace RJson {
+/**
+ * @brief GenericRPushReader是可恢复的SAX解析器，数据可以按任意长度分块推入。
+ * 解析状态(包括未结束的字符串、数字、转义序列和注释)在feed()之间保留，不需要先把全部数据拼接到一块连续内存。
+ * 每解析出一个值就调用一次handler，handler接口与rapidjson的Handler相同，因此解析可以与网络接收重叠进行。
+ * 数字文本交给rapidjson::Reader解码，数值语义与RDocument::fromJson()一致。
+ * 支持的解析选项：kParseFullPrecision、kParseNanAndInf、kParseComments、kParseTrailingCommas、kParseLazyNumbers。
+ * @code 典型用法
+ *      MyHandler handler;
+ *      GenericRPushReader<MyHandler> reader(handler);
+ *      while (auto n = recv(fd, buffer, sizeof(buffer), 0))
+ *          if (!reader.feed(buffer, n)) break;
+ *      if (!reader.finish())
+ *          printf("error:%d,offset:%u\n", reader.parseError(), (unsigned int)reader.errorOffset());
+ */
+template<typename Handler, unsigned parseFlags = kParseDefault>
+class GenericRPushReader {
+public:
+    explicit GenericRPushReader(Handler &handler) : _handler(handler) {}
+    GenericRPushReader(const GenericRPushReader &) = delete;
+    GenericRPushReader& operator=(const GenericRPushReader &) = delete;
+
+    /**
+     * @brief feed推入下一块数据，数据在返回后即可释放。
+     * @return 出错后返回false，之后的feed()不再处理数据
+     */
+    bool feed(const char *data, size_t size) {
+        const char *p = data;
+        const char *end = data + size;
+        while (p < end && _state != State::Error) {
+            switch (_state) {
+            case State::String: p = parseString(p, end); break;
+            case State::Number: p = parseNumber(p, end); break;
+            case State::Literal: p = parseLiteral(p, end); break;
+            default: p = parseStructural(p, end); break;
+            }
+        }
+        return _state != State::Error;
+    }
+
+    /// 数据推入完毕，结束解析，文档不完整时返回false
+    bool finish() {
+        if (_state == State::Error) return false;
+
+        //顶层数字没有结束符，在这里结束
+        if (_state == State::Number && !completeNumber()) return false;
+
+        if (_comment == Comment::Block || _comment == Comment::BlockStar || _comment == Comment::Slash)
+            return setError(rapidjson::kParseErrorUnspecificSyntaxError);
+        if (_state == State::Done) return true;
+
+        if (_state == State::Value && _stack.empty()) return setError(rapidjson::kParseErrorDocumentEmpty);
+        if (_state == State::String) return setError(rapidjson::kParseErrorStringMissQuotationMark);
+        if (_state == State::Literal) return setError(rapidjson::kParseErrorValueInvalid);
+        if (_state == State::Colon) return setError(rapidjson::kParseErrorObjectMissColon);
+        if (_state == State::ObjectFirstKey || _state == State::ObjectKey) return setError(rapidjson::kParseErrorObjectMissName);
+        if (!_stack.empty() && _stack.back().object) return setError(rapidjson::kParseErrorObjectMissCommaOrCurlyBracket);
+        if (!_stack.empty()) return setError(rapidjson::kParseErrorArrayMissCommaOrSquareBracket);
+        return setError(rapidjson::kParseErrorValueInvalid);
+    }
+
+    /// 重置状态，开始解析新的文档
+    void reset() {
+        _state = State::Value;
+        _comment = Comment::None;
+        _escape = Escape::None;
+        _stack.clear();
+        _token.clear();
+        _offset = 0;
+        _tokenOffset = 0;
+        _result.Clear();
+    }
+
+    bool isDone() const { return _state == State::Done; }
+    bool hasParseError() const { return _result.IsError(); }
+    rapidjson::ParseErrorCode parseError() const { return _result.Code(); }
+    /// 出错位置，相对于第一次feed()的数据起点
+    size_t errorOffset() const { return _result.Offset(); }
+    /// 已经处理的字节数
+    size_t offset() const { return _offset; }
+
+private:
+    enum class State {
+        Value,          ///< 期望一个值
+        ArrayFirstValue,///< '['之后，期望值或者']'
+        ArrayValue,     ///< 数组中','之后
+        ObjectFirstKey, ///< '{'之后，期望key或者'}'
+        ObjectKey,      ///< 对象中','之后
+        Colon,          ///< key之后
+        AfterValue,     ///< 容器中一个值之后，期望','或者结束符
+        String,
+        Number,
+        Literal,
+        Done,
+        Error
+    };
+    enum class Comment { None, Slash, Line, Block, BlockStar };
+    enum class Escape { None, Backslash, Unicode, SurrogateBackslash, SurrogateU, SurrogateUnicode };
+
+    struct Container {
+        bool object;
+        rapidjson::SizeType count;
+    };
+
+    /// 解码数字使用的选项，kParseLazyNumbers时以RawNumber事件给出原始文本
+    static const unsigned kNumberFlags =
+            (parseFlags & (rapidjson::kParseFullPrecisionFlag | rapidjson::kParseNanAndInfFlag))
+            | ((parseFlags & kParseLazyNumbers) != 0 ? rapidjson::kParseNumbersAsStringsFlag : 0);
+
+    bool setError(rapidjson::ParseErrorCode code) {
+        return setError(code, _offset);
+    }
+    bool setError(rapidjson::ParseErrorCode code, size_t offset) {
+        _state = State::Error;
+        _result.Set(code, offset);
+        return false;
+    }
+    bool check(bool ok) {
+        if (!ok) setError(rapidjson::kParseErrorTermination);
+        return ok;
+    }
+
+    /// 一个值结束，更新所在容器的计数
+    void afterValue() {
+        if (_stack.empty()) {
+            _state = State::Done;
+        } else {
+            ++_stack.back().count;
+            _state = State::AfterValue;
+        }
+    }
+
+    static bool isWhitespace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+    /// 处理注释，返回true表示c属于注释
+    bool skipComment(char c) {
+        switch (_comment) {
+        case Comment::None:
+            if (c != '/' || (parseFlags & rapidjson::kParseCommentsFlag) == 0) return false;
+            _comment = Comment::Slash;
+            return true;
+        case Comment::Slash:
+            if (c == '*') _comment = Comment::Block;
+            else if (c == '/') _comment = Comment::Line;
+            else setError(rapidjson::kParseErrorUnspecificSyntaxError);
+            return true;
+        case Comment::Line:
+            if (c == '\n') _comment = Comment::None;
+            return true;
+        case Comment::Block:
+            if (c == '*') _comment = Comment::BlockStar;
+            return true;
+        case Comment::BlockStar:
+            if (c == '/') _comment = Comment::None;
+            else if (c != '*') _comment = Comment::Block;
+            return true;
+        }
+        return false;
+    }
+
+    /// 处理字符串、数字和字面量以外的状态，每次消耗一个字符
+    const char* parseStructural(const char *p, const char *end) {
+        for (; p < end; ++p, ++_offset) {
+            char c = *p;
+            if (skipComment(c)) {
+                if (_state == State::Error) return p;
+                continue;
+            }
+            if (isWhitespace(c)) continue;
+
+            switch (_state) {
+            case State::ArrayFirstValue:
+            case State::ArrayValue:
+                if (c == ']' && (_state == State::ArrayFirstValue || (parseFlags & rapidjson::kParseTrailingCommasFlag) != 0)) {
+                    endContainer();
+                    break;
+                }
+                return beginValue(p);
+            case State::Value:
+                return beginValue(p);
+            case State::ObjectFirstKey:
+            case State::ObjectKey:
+                if (c == '}' && (_state == State::ObjectFirstKey || (parseFlags & rapidjson::kParseTrailingCommasFlag) != 0)) {
+                    endContainer();
+                    break;
+                }
+                if (c != '"') {
+                    setError(rapidjson::kParseErrorObjectMissName);
+                    return p;
+                }
+                beginString(true);
+                ++_offset;
+                return p + 1;
+            case State::Colon:
+                if (c != ':') {
+                    setError(rapidjson::kParseErrorObjectMissColon);
+                    return p;
+                }
+                _state = State::Value;
+                break;
+            case State::AfterValue:
+                if (_stack.back().object) {
+                    if (c == ',') _state = State::ObjectKey;
+                    else if (c == '}') endContainer();
+                    else setError(rapidjson::kParseErrorObjectMissCommaOrCurlyBracket);
+                } else {
+                    if (c == ',') _state = State::ArrayValue;
+                    else if (c == ']') endContainer();
+                    else setError(rapidjson::kParseErrorArrayMissCommaOrSquareBracket);
+                }
+                if (_state == State::Error) return p;
+                break;
+            case State::Done:
+                setError(rapidjson::kParseErrorDocumentRootNotSingular);
+                return p;
+            default:
+                return p;
+            }
+            if (_state == State::Error) return p;
+        }
+        return p;
+    }
+
+    /// p指向值的第一个字符
+    const char* beginValue(const char *p) {
+        char c = *p;
+        switch (c) {
+        case '{':
+            if (!check(_handler.StartObject())) return p;
+            _stack.push_back(Container{true, 0});
+            _state = State::ObjectFirstKey;
+            ++_offset;
+            return p + 1;
+        case '[':
+            if (!check(_handler.StartArray())) return p;
+            _stack.push_back(Container{false, 0});
+            _state = State::ArrayFirstValue;
+            ++_offset;
+            return p + 1;
+        case '"':
+            beginString(false);
+            ++_offset;
+            return p + 1;
+        case 't':
+            beginLiteral("true");
+            return p;
+        case 'f':
+            beginLiteral("false");
+            return p;
+        case 'n':
+            beginLiteral("null");
+            return p;
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')
+                    || ((parseFlags & rapidjson::kParseNanAndInfFlag) != 0 && (c == 'N' || c == 'I'))) {
+                _state = State::Number;
+                _token.clear();
+                _tokenOffset = _offset;
+                return p;
+            }
+            setError(rapidjson::kParseErrorValueInvalid);
+            return p;
+        }
+    }
+
+    void endContainer() {
+        Container container = _stack.back();
+        _stack.pop_back();
+        bool ok = container.object ? _handler.EndObject(container.count) : _handler.EndArray(container.count);
+        if (!check(ok)) return;
+        afterValue();
+    }
+
+    void beginLiteral(const char *literal) {
+        _state = State::Literal;
+        _literal = literal;
+        _literalMatched = 0;
+        _tokenOffset = _offset;
+    }
+
+    const char* parseLiteral(const char *p, const char *end) {
+        for (; p < end; ++p, ++_offset) {
+            if (*p != _literal[_literalMatched]) {
+                setError(rapidjson::kParseErrorValueInvalid, _tokenOffset);
+                return p;
+            }
+            if (_literal[++_literalMatched] != '\0') continue;
+
+            bool ok = _literal[0] == 'n' ? _handler.Null() : _handler.Bool(_literal[0] == 't');
+            if (check(ok)) afterValue();
+            ++_offset;
+            return p + 1;
+        }
+        return p;
+    }
+
+    static bool isNumberChar(char c) {
+        if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') return true;
+        if ((parseFlags & rapidjson::kParseNanAndInfFlag) == 0) return false;
+        //NaN、Inf、Infinity
+        return c == 'N' || c == 'a' || c == 'I' || c == 'n' || c == 'f' || c == 'i' || c == 't' || c == 'y';
+    }
+
+    const char* parseNumber(const char *p, const char *end) {
+        const char *begin = p;
+        while (p < end && isNumberChar(*p)) ++p;
+        _token.append(begin, p);
+        _offset += static_cast<size_t>(p - begin);
+
+        //遇到结束符，结束符留给下一个状态处理
+        if (p < end) completeNumber();
+        return p;
+    }
+
+    bool completeNumber() {
+        rapidjson::StringStream stream(_token.c_str());
+        _numberReader.template Parse<kNumberFlags>(stream, _handler);
+        if (_numberReader.HasParseError()) {
+            auto code = _numberReader.GetParseErrorCode();
+            //数字后面不可能还有内容，RootNotSingular说明数字本身不合法
+            if (code == rapidjson::kParseErrorDocumentRootNotSingular) code = rapidjson::kParseErrorValueInvalid;
+            return setError(code, _tokenOffset + _numberReader.GetErrorOffset());
+        }
+        afterValue();
+        return true;
+    }
+
+    void beginString(bool key) {
+        _state = State::String;
+        _key = key;
+        _escape = Escape::None;
+        _token.clear();
+        _tokenOffset = _offset;
+    }
+
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    void appendUtf8(unsigned codepoint) {
+        if (codepoint <= 0x7F) {
+            _token += static_cast<char>(codepoint);
+        } else if (codepoint <= 0x7FF) {
+            _token += static_cast<char>(0xC0 | ((codepoint >> 6) & 0xFF));
+            _token += static_cast<char>(0x80 | (codepoint & 0x3F));
+        } else if (codepoint <= 0xFFFF) {
+            _token += static_cast<char>(0xE0 | ((codepoint >> 12) & 0xFF));
+            _token += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            _token += static_cast<char>(0x80 | (codepoint & 0x3F));
+        } else {
+            _token += static_cast<char>(0xF0 | ((codepoint >> 18) & 0xFF));
+            _token += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+            _token += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            _token += static_cast<char>(0x80 | (codepoint & 0x3F));
+        }
+    }
+
+    /// 处理转义序列中的一个字符
+    void parseEscape(char c) {
+        switch (_escape) {
+        case Escape::Backslash:
+            _escape = Escape::None;
+            switch (c) {
+            case '"': _token += '"'; break;
+            case '\\': _token += '\\'; break;
+            case '/': _token += '/'; break;
+            case 'b': _token += '\b'; break;
+            case 'f': _token += '\f'; break;
+            case 'n': _token += '\n'; break;
+            case 'r': _token += '\r'; break;
+            case 't': _token += '\t'; break;
+            case 'u':
+                _escape = Escape::Unicode;
+                _hexDigits = 0;
+                _codepoint = 0;
+                break;
+            default:
+                setError(rapidjson::kParseErrorStringEscapeInvalid, _offset - 1);
+                break;
+            }
+            break;
+        case Escape::Unicode:
+        case Escape::SurrogateUnicode: {
+            int digit = hexValue(c);
+            if (digit < 0) {
+                setError(rapidjson::kParseErrorStringUnicodeEscapeInvalidHex);
+                return;
+            }
+            _codepoint = (_codepoint << 4) | static_cast<unsigned>(digit);
+            if (++_hexDigits < 4) return;
+
+            if (_escape == Escape::SurrogateUnicode) {
+                if (_codepoint < 0xDC00 || _codepoint > 0xDFFF) {
+                    setError(rapidjson::kParseErrorStringUnicodeSurrogateInvalid);
+                    return;
+                }
+                appendUtf8((((_highSurrogate - 0xD800) << 10) | (_codepoint - 0xDC00)) + 0x10000);
+                _escape = Escape::None;
+            } else if (_codepoint >= 0xD800 && _codepoint <= 0xDBFF) {
+                _highSurrogate = _codepoint;
+                _escape = Escape::SurrogateBackslash;
+            } else if (_codepoint >= 0xDC00 && _codepoint <= 0xDFFF) {
+                setError(rapidjson::kParseErrorStringUnicodeSurrogateInvalid);
+            } else {
+                appendUtf8(_codepoint);
+                _escape = Escape::None;
+            }
+            break;
+        }
+        case Escape::SurrogateBackslash:
+            if (c != '\\') {
+                setError(rapidjson::kParseErrorStringUnicodeSurrogateInvalid);
+                return;
+            }
+            _escape = Escape::SurrogateU;
+            break;
+        case Escape::SurrogateU:
+            if (c != 'u') {
+                setError(rapidjson::kParseErrorStringUnicodeSurrogateInvalid);
+                return;
+            }
+            _escape = Escape::SurrogateUnicode;
+            _hexDigits = 0;
+            _codepoint = 0;
+            break;
+        case Escape::None:
+            break;
+        }
+    }
+
+    const char* parseString(const char *p, const char *end) {
+        while (p < end) {
+            if (_escape != Escape::None) {
+                parseEscape(*p);
+                if (_state == State::Error) return p;
+                ++p;
+                ++_offset;
+                continue;
+            }
+
+            //批量拷贝不需要处理的字符
+            const char *begin = p;
+            while (p < end && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20) ++p;
+            _token.append(begin, p);
+            _offset += static_cast<size_t>(p - begin);
+            if (p == end) return p;
+
+            char c = *p;
+            if (c == '\\') {
+                _escape = Escape::Backslash;
+                ++p;
+                ++_offset;
+                continue;
+            }
+            if (c != '"') {
+                setError(c == '\0' ? rapidjson::kParseErrorStringMissQuotationMark : rapidjson::kParseErrorStringInvalidEncoding);
+                return p;
+            }
+
+            ++p;
+            ++_offset;
+            auto length = static_cast<rapidjson::SizeType>(_token.size());
+            if (_key) {
+                if (check(_handler.Key(_token.c_str(), length, true))) _state = State::Colon;
+            } else if (check(_handler.String(_token.c_str(), length, true))) {
+                afterValue();
+            }
+            return p;
+        }
+        return p;
+    }
+
+private:
+    Handler &_handler;
+    State _state = State::Value;
+    Comment _comment = Comment::None;
+    Escape _escape = Escape::None;
+    std::vector<Container> _stack;
+
+    /// 未结束的字符串或者数字
+    std::string _token;
+    size_t _tokenOffset = 0;
+    bool _key = false;
+    unsigned _codepoint = 0;
+    unsigned _highSurrogate = 0;
+    int _hexDigits = 0;
+    const char *_literal = nullptr;
+    size_t _literalMatched = 0;
+
+    size_t _offset = 0;
+    rapidjson::ParseResult _result;
+    rapidjson::Reader _numberReader;
+};
+
+/**
+ * @brief GenericRPushParser按块推入数据构造RDocument，数据到达时即构造文档节点。
+ * parseFlags与RDocument::fromJson()相同，支持kParseLazyNumbers、kParseInternKeys和kParsePackArrays。
+ * @code 典型用法
+ *      RPushParser parser;
+ *      for (auto &chunk : chunks)
+ *          parser.feed(chunk.data(), chunk.size());
+ *      if (parser.finish()) {
+ *          RDocument doc = parser.takeDocument();
+ *          print(doc);
+ *      }
+ */
+template<unsigned parseFlags = kParseDefault>
+class GenericRPushParser {
+public:
+    GenericRPushParser() { start(); }
+    GenericRPushParser(const GenericRPushParser &) = delete;
+    GenericRPushParser& operator=(const GenericRPushParser &) = delete;
+
+    /// 推入下一块数据，finish()或takeDocument()之后需要先调用reset()
+    bool feed(const char *data, size_t size) {
+        if (_finished || _taken) {
+            printf("RPushParser feed error, parser is finished, call reset() first.\n");
+            return false;
+        }
+        return _reader->feed(data, size);
+    }
+
+    /// 结束解析，成功时document()为解析结果，失败时文档保持为空；重复调用返回第一次的结果
+    bool finish() {
+        if (_finished) return !_doc._result.IsError();
+        if (_taken) {
+            printf("RPushParser finish error, document is taken, call reset() first.\n");
+            return false;
+        }
+        _finished = true;
+
+        bool ok = _reader->finish();
+        //节点都已在rapidjson::Document的栈上，成功时移动到根节点，失败时清空
+        auto generator = [ok](rapidjson::Document &) { return ok; };
+        _doc._doc.Populate(generator);
+        _doc.modified();
+        _doc._result = result();
+        return ok;
+    }
+
+    /// 清空解析状态和文档，开始解析下一个消息，例如同一连接上的下一条JSON
+    void reset() {
+        _reader.reset();
+        _handler.reset();
+        _doc = RDocument();
+        start();
+    }
+
+    bool hasParseError() const { return result().IsError(); }
+    rapidjson::ParseErrorCode parseError() const { return result().Code(); }
+    size_t errorOffset() const { return result().Offset(); }
+
+    RDocument& document() { return _doc; }
+    /// 取出解析结果，之后需要调用reset()才能继续使用解析器
+    RDocument takeDocument() {
+        _taken = true;
+        return std::move(_doc);
+    }
+
+private:
+    /// handler引用文档和key字典，文档替换后重新构造
+    void start() {
+        _finished = false;
+        _taken = false;
+        _handler.reset(new detail::DocumentHandler(_doc._doc, keyPool(_doc), (parseFlags & kParsePackArrays) != 0));
+        _reader.reset(new GenericRPushReader<detail::DocumentHandler, parseFlags>(*_handler));
+    }
+
+    rapidjson::ParseResult result() const {
+        return _handler->result(rapidjson::ParseResult(_reader->parseError(), _reader->errorOffset()));
+    }
+
+    static detail::KeyPool* keyPool(RDocument &doc) {
+        if ((parseFlags & kParseInternKeys) != 0)
+            doc.setKeyInterning(true);
+        return doc._keys.get();
+    }
+
+private:
+    RDocument _doc;
+    std::unique_ptr<detail::DocumentHandler> _handler;
+    std::unique_ptr<GenericRPushReader<detail::DocumentHandler, parseFlags>> _reader;
+    bool _finished = false;
+    bool _taken = false;
+};
+
+using RPushParser = GenericRPushParser<>;
+}
+
+#endif// __RPushParser_H__
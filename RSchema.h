@@ -0,0 +1,209 @@
+/****************************************************************************
+** Copyright (C) 2021. All rights reserved.
+**
+** Licensed under the MIT License (the "License"); you may not use this file except
+** in compliance with the License. You may obtain a copy of the License at
+**
+** http://opensource.org/licenses/MIT
+**
+** Unless required by applicable law or agreed to in writing, software distributed
+** under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+** CONDITIONS OF ANY KIND, either express or implied. See the License for the
+** specific language governing permissions and limitations under the License.
+****************************************************************************/
+#ifndef __RSchema_H__
+#define __RSchema_H__
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "RJson.h"
+#include "rapidjson/schema.h"
+
+namespace RJson {
+namespace detail {
+/// 同一个SAX事件先交给校验器，通过后再交给文档构造，校验失败时立即中止解析
+class ValidatingHandler {
+public:
+    ValidatingHandler(rapidjson::SchemaValidator &validator, DocumentHandler &output)
+        : _validator(validator), _output(output) {}
+
+    bool Null() { return _validator.Null() && _output.Null(); }
+    bool Bool(bool b) { return _validator.Bool(b) && _output.Bool(b); }
+    bool Int(int i) { return _validator.Int(i) && _output.Int(i); }
+    bool Uint(unsigned u) { return _validator.Uint(u) && _output.Uint(u); }
+    bool Int64(int64_t i) { return _validator.Int64(i) && _output.Int64(i); }
+    bool Uint64(uint64_t u) { return _validator.Uint64(u) && _output.Uint64(u); }
+    bool Double(double d) { return _validator.Double(d) && _output.Double(d); }
+    bool RawNumber(const char *str, rapidjson::SizeType length, bool copy) {
+        //校验器把RawNumber当作字符串校验，这里解码成数值事件交给校验器，文档中仍保存原始文本
+        rapidjson::Value number;
+        if (!decodeNumber(str, length, number)) return false;
+        return number.Accept(_validator) && _output.RawNumber(str, length, copy);
+    }
+    bool String(const char *str, rapidjson::SizeType length, bool copy) {
+        return _validator.String(str, length, copy) && _output.String(str, length, copy);
+    }
+    bool StartObject() { return _validator.StartObject() && _output.StartObject(); }
+    bool Key(const char *str, rapidjson::SizeType length, bool copy) {
+        return _validator.Key(str, length, copy) && _output.Key(str, length, copy);
+    }
+    bool EndObject(rapidjson::SizeType memberCount) {
+        return _validator.EndObject(memberCount) && _output.EndObject(memberCount);
+    }
+    bool StartArray() { return _validator.StartArray() && _output.StartArray(); }
+    bool EndArray(rapidjson::SizeType elementCount) {
+        return _validator.EndArray(elementCount) && _output.EndArray(elementCount);
+    }
+
+private:
+    rapidjson::SchemaValidator &_validator;
+    DocumentHandler &_output;
+};
+}
+
+/// 校验失败的位置
+struct RSchemaViolation {
+    /// 失败的schema规则，JSON Pointer格式，例如"/properties/age"
+    std::string schemaPointer;
+    /// 失败的schema关键字，例如"minimum"、"required"
+    std::string keyword;
+    /// 文档中不满足规则的值，JSON Pointer格式，例如"/age"
+    std::string documentPointer;
+    /// 中止解析时的输入偏移
+    size_t offset = 0;
+};
+
+/**
+ * @brief RSchema是编译后的JSON Schema，解析文档时在同一遍SAX中完成校验，不需要再遍历一次DOM。
+ * 遇到第一个不满足schema的值时立即中止解析，通过RSchemaViolation给出失败的规则、文档路径和偏移。
+ * RSchema构造后只读，可以在多个线程中同时用于解析。
+ * @code 典型用法
+ *      RSchema schema(schemaText.c_str(), schemaText.size());
+ *      RDocument doc;
+ *      RSchemaViolation violation;
+ *      if (!schema.parse(doc, data, size, &violation))
+ *          printf("%s %s offset:%u\n", violation.keyword.c_str(), violation.documentPointer.c_str(), (unsigned int)violation.offset);
+ */
+class RSchema {
+public:
+    RSchema(const char *data, size_t size) {
+        rapidjson::Document source;
+        source.Parse(data, size);
+        _result = rapidjson::ParseResult(source.GetParseError(), source.GetErrorOffset());
+        if (!_result.IsError())
+            _schema.reset(new rapidjson::SchemaDocument(source));
+    }
+    RSchema(const RSchema &) = delete;
+    RSchema& operator=(const RSchema &) = delete;
+
+    /// schema文本是否解析成功
+    bool isValid() const { return _schema != nullptr; }
+    bool hasParseError() const { return _result.IsError(); }
+    size_t errorOffset() const { return _result.Offset(); }
+    std::string parseErrorString() const { return rapidjson::GetParseError_En(_result.Code()); }
+
+    /**
+     * @brief parse解析并校验JSON文本，结果保存到doc中
+     * @param violation 不为空时，校验失败后保存失败位置
+     * @return 语法正确且满足schema时返回true；失败时doc.hasParseError()为true
+     */
+    template<unsigned parseFlags = kParseDefault>
+    bool parse(RDocument &doc, const char *data, size_t size, RSchemaViolation *violation = nullptr) const {
+        static const unsigned flags = parseFlags & ~static_cast<unsigned>(kParseLazyNumbers | kParseInternKeys | kParsePackArrays);
+        if (!isValid()) {
+            printf("RSchema parse error, invalid schema.\n");
+            doc._result = rapidjson::ParseResult(rapidjson::kParseErrorTermination, 0);
+            return false;
+        }
+        if ((parseFlags & kParseInternKeys) != 0)
+            doc.setKeyInterning(true);
+
+        doc.modified();
+        rapidjson::SchemaValidator validator(*_schema);
+        rapidjson::Reader reader;
+        rapidjson::MemoryStream stream(data, size);
+        auto generator = [&](rapidjson::Document &d) {
+            detail::DocumentHandler output(d, doc._keys.get(), (parseFlags & kParsePackArrays) != 0);
+            detail::ValidatingHandler handler(validator, output);
+            doc._result = output.result(reader.Parse<flags | (parseFlags & kParseLazyNumbers ? rapidjson::kParseNumbersAsStringsFlag : 0)>(stream, handler));
+            return !doc._result.IsError();
+        };
+        doc._doc.Populate(generator);
+
+        if (!validator.IsValid() && violation != nullptr) {
+            rapidjson::StringBuffer schemaPointer, documentPointer;
+            validator.GetInvalidSchemaPointer().Stringify(schemaPointer);
+            validator.GetInvalidDocumentPointer().Stringify(documentPointer);
+            violation->schemaPointer.assign(schemaPointer.GetString(), schemaPointer.GetSize());
+            violation->keyword = validator.GetInvalidSchemaKeyword();
+            violation->documentPointer.assign(documentPointer.GetString(), documentPointer.GetSize());
+            violation->offset = doc._result.Offset();
+        }
+        return !doc._result.IsError();
+    }
+
+    template<unsigned parseFlags = kParseDefault>
+    RDocument fromJson(const char *data, size_t size, RSchemaViolation *violation = nullptr) const {
+        RDocument d;
+        parse<parseFlags>(d, data, size, violation);
+        return d;
+    }
+
+private:
+    std::unique_ptr<rapidjson::SchemaDocument> _schema;
+    rapidjson::ParseResult _result;
+};
+
+/**
+ * @brief RSchemaCache按名称缓存编译后的schema，多个线程可以同时查询和添加。
+ * 返回的std::shared_ptr在schema被替换或移除后仍然有效。
+ */
+class RSchemaCache {
+public:
+    /// 查找schema，不存在时返回空指针
+    std::shared_ptr<const RSchema> get(const std::string &name) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _schemas.find(name);
+        return it != _schemas.end() ? it->second : nullptr;
+    }
+
+    /// 编译并添加schema，同名schema被替换；schema文本有误时返回空指针，缓存不变
+    std::shared_ptr<const RSchema> add(const std::string &name, const char *data, size_t size) {
+        //编译在锁外进行，不阻塞其他线程查询
+        std::shared_ptr<const RSchema> schema = std::make_shared<RSchema>(data, size);
+        if (!schema->isValid()) {
+            printf("RSchemaCache add error, schema:%s, %s, offset:%u.\n", name.c_str(),
+                   schema->parseErrorString().c_str(), (unsigned int)schema->errorOffset());
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _schemas[name] = schema;
+        return schema;
+    }
+
+    bool remove(const std::string &name) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _schemas.erase(name) > 0;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _schemas.clear();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _schemas.size();
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::map<std::string, std::shared_ptr<const RSchema>> _schemas;
+};
+}
+
+#endif// __RSchema_H__
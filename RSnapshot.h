@@ -0,0 +1,664 @@
+/****************************************************************************
+** Copyright (C) 2021. All rights reserved.
+**
+** Licensed under the MIT License (the "License"); you may not use this file except
+** in compliance with the License. You may obtain a copy of the License at
+**
+** http://opensource.org/licenses/MIT
+**
+** Unless required by applicable law or agreed to in writing, software distributed
+** under the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+** CONDITIONS OF ANY KIND, either express or implied. See the License for the
+** specific language governing permissions and limitations under the License.
+****************************************************************************/
+#ifndef __RSnapshot_H__
+#define __RSnapshot_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "RJson.h"
+
+namespace RJson {
+/**
+ * @brief RSnapshot类是不可变的JSON快照，节点之间通过std::shared_ptr结构共享。
+ * set()/remove()不修改原快照，而是返回新快照：只复制从根节点到被修改节点路径上的节点，
+ * 未修改的子树由新旧快照共享，因此发布新版本配置的代价与修改路径长度相关，与文档大小无关。
+ * 路径使用JSON Pointer语法，例如"/servers/0/port"，数组下标"-"表示追加。
+ * 快照创建后不再变化，任意线程可同时读取。
+ * @code 典型用法
+ *      auto v1 = RSnapshot::fromJson(txt.c_str(), txt.size());
+ *      auto v2 = v1.set("/servers/0/port", 8080);
+ *      //v1不变，v2与v1共享除"/servers/0"路径以外的全部节点
+ *      printf("%s\n%s\n", v1.toJson().c_str(), v2.toJson().c_str());
+ */
+class RSnapshot {
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    enum class Kind { Null, Bool, Int64, Uint64, Double, String, Array, Object };
+
+    /// 标量保存在union中，字符串、数组和对象的内容只为对应类型的节点单独分配，节点本身只有16字节
+    struct Node {
+        using Items = std::vector<NodePtr>;
+        using Members = std::vector<std::pair<std::string, NodePtr>>;
+
+        explicit Node(Kind k) : kind(k) {
+            switch (kind) {
+            case Kind::String: str = new std::string(); break;
+            case Kind::Array: items = new Items(); break;
+            case Kind::Object: members = new Members(); break;
+            default: u = 0; break;
+            }
+        }
+        //写时复制只复制当前节点，子节点指针仍然共享
+        Node(const Node &other) : kind(other.kind) {
+            switch (kind) {
+            case Kind::Null: u = 0; break;
+            case Kind::Bool: b = other.b; break;
+            case Kind::Int64: i = other.i; break;
+            case Kind::Uint64: u = other.u; break;
+            case Kind::Double: d = other.d; break;
+            case Kind::String: str = new std::string(*other.str); break;
+            case Kind::Array: items = new Items(*other.items); break;
+            case Kind::Object: members = new Members(*other.members); break;
+            }
+        }
+        Node& operator=(const Node &) = delete;
+        ~Node() {
+            switch (kind) {
+            case Kind::String: delete str; break;
+            case Kind::Array: delete items; break;
+            case Kind::Object: delete members; break;
+            default: break;
+            }
+        }
+
+        const Kind kind;
+        union {
+            bool b;
+            int64_t i;
+            uint64_t u;
+            double d;
+            std::string *str;
+            Items *items;
+            Members *members;
+        };
+    };
+
+public:
+    /// 无效快照，isValid()为false
+    RSnapshot() {}
+    //标量快照，用作set()的参数
+    RSnapshot(std::nullptr_t) : _node(makeNode(Kind::Null)) {}
+    RSnapshot(bool b) : _node(makeBool(b)) {}
+    RSnapshot(int n) : _node(makeInt64(n)) {}
+    RSnapshot(unsigned int n) : _node(makeUint64(n)) {}
+    RSnapshot(long long n) : _node(makeInt64(n)) {}
+    RSnapshot(unsigned long long n) : _node(makeUint64(n)) {}
+    RSnapshot(double d) : _node(makeDouble(d)) {}
+    RSnapshot(const std::string &s) : _node(makeString(s.c_str(), s.size())) {}
+    RSnapshot(const char *s) : _node(makeString(s, strlen(s))) {}
+
+    /// 从只读视图构造快照，深拷贝一次，之后的修改都只复制路径
+    explicit RSnapshot(const RConstValue &value) {
+        Builder builder;
+        if (value.accept(builder))
+            _node = builder.root;
+    }
+    explicit RSnapshot(const RDocument &doc) : RSnapshot(doc.root()) {}
+
+    bool isValid() const { return _node != nullptr; }
+    explicit operator bool() const { return isValid(); }
+
+    //判断值类型，无效快照均返回false
+    bool isArray() const { return is(Kind::Array); }
+    bool isBool() const { return is(Kind::Bool); }
+    bool isDouble() const { return is(Kind::Double); }
+    bool isNull() const { return is(Kind::Null); }
+    bool isNumber() const { return is(Kind::Int64) || is(Kind::Uint64) || is(Kind::Double); }
+    bool isObject() const { return is(Kind::Object); }
+    bool isString() const { return is(Kind::String); }
+
+    //值转换
+    bool toBool(bool defaultValue = false) const {
+        if (!isBool()) return defaultValue;
+        return _node->b;
+    }
+    double toDouble(double defaultValue = 0) const {
+        if (is(Kind::Double)) return _node->d;
+        if (is(Kind::Int64)) return static_cast<double>(_node->i);
+        if (is(Kind::Uint64)) return static_cast<double>(_node->u);
+        return defaultValue;
+    }
+    int toInt(int defaultValue = 0) const {
+        long long n = toLonglong(defaultValue);
+        if (n < INT32_MIN || n > INT32_MAX) return defaultValue;
+        return static_cast<int>(n);
+    }
+    long long toLonglong(long long defaultValue = 0) const {
+        if (is(Kind::Int64)) return _node->i;
+        if (is(Kind::Uint64) && _node->u <= static_cast<uint64_t>(INT64_MAX)) return static_cast<long long>(_node->u);
+        return defaultValue;
+    }
+    unsigned long long toULonglong(unsigned long long defaultValue = 0) const {
+        if (is(Kind::Uint64)) return _node->u;
+        if (is(Kind::Int64) && _node->i >= 0) return static_cast<unsigned long long>(_node->i);
+        return defaultValue;
+    }
+    std::string toString(const std::string &defaultValue = "") const {
+        if (!isString()) return defaultValue;
+        return *_node->str;
+    }
+
+    //只读访问，返回的子快照与当前快照共享节点
+    RSnapshot find(const std::string &key) const {
+        if (!isObject()) return {};
+        for (auto &member : *_node->members) {
+            if (member.first == key) return RSnapshot(member.second);
+        }
+        return {};
+    }
+    bool contains(const std::string &key) const { return find(key).isValid(); }
+    RSnapshot at(unsigned int i) const {
+        if (!isArray() || i >= _node->items->size()) return {};
+        return RSnapshot((*_node->items)[i]);
+    }
+    /// 按照JSON Pointer路径访问，例如"/servers/0/port"
+    RSnapshot get(const std::string &pointer) const {
+        std::vector<std::string> tokens;
+        if (!isValid() || !parsePointer(pointer, tokens)) return {};
+
+        RSnapshot current = *this;
+        for (auto &token : tokens) {
+            if (current.isObject()) {
+                current = current.find(token);
+            } else {
+                unsigned int index = 0;
+                if (!parseIndex(token, index)) return {};
+                current = current.at(index);
+            }
+            if (!current) return {};
+        }
+        return current;
+    }
+    unsigned int size() const {
+        if (isArray()) return static_cast<unsigned int>(_node->items->size());
+        if (isObject()) return static_cast<unsigned int>(_node->members->size());
+        return 0;
+    }
+    std::vector<std::string> keys() const {
+        std::vector<std::string> result;
+        if (!isObject()) return result;
+        result.reserve(_node->members->size());
+        for (auto &member : *_node->members) result.push_back(member.first);
+        return result;
+    }
+
+    //修改操作，均返回新快照，原快照保持不变
+    /**
+     * @brief set将pointer路径上的值替换为value，返回新快照。
+     * 路径上不存在的对象成员会被创建，中间遇到非对象、非数组的值时直接替换为对象，
+     * 这一点与RValue::operator[]不同，后者拒绝修改并输出错误。
+     * 数组下标等于数组长度或者为"-"时追加，下标越界时返回无效快照。
+     */
+    RSnapshot set(const std::string &pointer, const RSnapshot &value) const {
+        std::vector<std::string> tokens;
+        if (!value.isValid() || !parsePointer(pointer, tokens)) return {};
+
+        RSnapshot result;
+        result._node = setAt(_node, tokens, 0, value._node);
+        return result;
+    }
+    /// 删除pointer路径上的值，路径不存在时返回与当前快照共享全部节点的新快照
+    RSnapshot remove(const std::string &pointer) const {
+        std::vector<std::string> tokens;
+        if (!isValid() || !parsePointer(pointer, tokens) || tokens.empty()) return {};
+
+        RSnapshot result;
+        result._node = removeAt(_node, tokens, 0);
+        return result;
+    }
+
+    /// 判断两个快照是否共享同一个根节点，共享时内容必然相等
+    bool sharesWith(const RSnapshot &other) const { return _node == other._node; }
+
+    bool operator==(const RSnapshot &other) const { return equal(_node, other._node); }
+    bool operator!=(const RSnapshot &other) const { return !(*this == other); }
+
+    /// 以SAX方式遍历快照，handler接口与rapidjson的Handler相同
+    template<typename Handler>
+    bool accept(Handler &handler) const {
+        if (!isValid()) return false;
+        return acceptNode(*_node, handler);
+    }
+
+    std::string toJson() const {
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        if (!accept(writer)) return {};
+        return buffer.GetString();
+    }
+
+    /// 转成可修改的文档，深拷贝
+    RDocument toDocument() const {
+        RDocument doc;
+        if (!isValid()) return doc;
+
+        //经过DocumentHandler，拒绝以内部标记字节开头的字符串
+        auto generator = [this](rapidjson::Document &d) {
+            detail::DocumentHandler handler(d);
+            if (accept(handler)) return true;
+            printf("RSnapshot toDocument error, string starts with invalid UTF-8 byte.\n");
+            return false;
+        };
+        doc._doc.Populate(generator);
+        return doc;
+    }
+
+public:
+    /// 空数组快照，用于set()创建数组
+    static RSnapshot array() { return RSnapshot(NodePtr(makeNode(Kind::Array))); }
+    /// 空对象快照
+    static RSnapshot object() { return RSnapshot(NodePtr(makeNode(Kind::Object))); }
+
+    /// 解析JSON文本，解析失败时返回无效快照
+    static RSnapshot fromJson(const char* data, size_t size) {
+        auto doc = RDocument::fromJson(data, size);
+        if (doc.hasParseError()) {
+            printf("RSnapshot fromJson error, %s, offset:%u.\n", doc.parseErrorString().c_str(), (unsigned int)doc.errorOffset());
+            return {};
+        }
+        return RSnapshot(doc);
+    }
+
+private:
+    explicit RSnapshot(const NodePtr &node) : _node(node) {}
+
+    bool is(Kind kind) const { return _node != nullptr && _node->kind == kind; }
+
+    static std::shared_ptr<Node> makeNode(Kind kind) { return std::make_shared<Node>(kind); }
+    static std::shared_ptr<Node> makeBool(bool b) {
+        auto node = makeNode(Kind::Bool);
+        node->b = b;
+        return node;
+    }
+    static std::shared_ptr<Node> makeInt64(int64_t n) {
+        auto node = makeNode(Kind::Int64);
+        node->i = n;
+        return node;
+    }
+    static std::shared_ptr<Node> makeUint64(uint64_t n) {
+        auto node = makeNode(Kind::Uint64);
+        node->u = n;
+        return node;
+    }
+    static std::shared_ptr<Node> makeDouble(double d) {
+        auto node = makeNode(Kind::Double);
+        node->d = d;
+        return node;
+    }
+    static std::shared_ptr<Node> makeString(const char *s, size_t size) {
+        auto node = makeNode(Kind::String);
+        node->str->assign(s, size);
+        return node;
+    }
+
+    /// 解析JSON Pointer，""表示根节点，"~1"转义"/"，"~0"转义"~"
+    static bool parsePointer(const std::string &pointer, std::vector<std::string> &tokens) {
+        if (pointer.empty()) return true;
+        if (pointer[0] != '/') return false;
+
+        std::string token;
+        for (size_t i = 1; i <= pointer.size(); ++i) {
+            if (i == pointer.size() || pointer[i] == '/') {
+                tokens.push_back(token);
+                token.clear();
+            } else if (pointer[i] == '~') {
+                if (i + 1 >= pointer.size()) return false;
+                char c = pointer[++i];
+                if (c == '0') token += '~';
+                else if (c == '1') token += '/';
+                else return false;
+            } else {
+                token += pointer[i];
+            }
+        }
+        return true;
+    }
+
+    static bool parseIndex(const std::string &token, unsigned int &index) {
+        if (token.empty() || token.size() > 10) return false;
+        if (token.size() > 1 && token[0] == '0') return false;
+        unsigned long long n = 0;
+        for (char c : token) {
+            if (c < '0' || c > '9') return false;
+            n = n * 10 + static_cast<unsigned long long>(c - '0');
+        }
+        if (n > UINT32_MAX) return false;
+        index = static_cast<unsigned int>(n);
+        return true;
+    }
+
+    static NodePtr setAt(const NodePtr &node, const std::vector<std::string> &tokens, size_t depth, const NodePtr &value) {
+        if (depth == tokens.size()) return value;
+
+        auto &token = tokens[depth];
+        if (node != nullptr && node->kind == Kind::Array) {
+            //只复制当前数组节点，子节点仍然共享
+            auto copy = std::make_shared<Node>(*node);
+            unsigned int index = 0;
+            if (token == "-") {
+                index = static_cast<unsigned int>(copy->items->size());
+            } else if (!parseIndex(token, index) || index > copy->items->size()) {
+                return nullptr;
+            }
+
+            if (index == copy->items->size()) {
+                auto child = setAt(nullptr, tokens, depth + 1, value);
+                if (child == nullptr) return nullptr;
+                copy->items->push_back(child);
+            } else {
+                auto child = setAt((*copy->items)[index], tokens, depth + 1, value);
+                if (child == nullptr) return nullptr;
+                (*copy->items)[index] = child;
+            }
+            return copy;
+        }
+
+        std::shared_ptr<Node> copy;
+        if (node != nullptr && node->kind == Kind::Object)
+            copy = std::make_shared<Node>(*node);
+        else
+            copy = makeNode(Kind::Object);
+
+        for (auto &member : *copy->members) {
+            if (member.first == token) {
+                auto child = setAt(member.second, tokens, depth + 1, value);
+                if (child == nullptr) return nullptr;
+                member.second = child;
+                return copy;
+            }
+        }
+
+        auto child = setAt(nullptr, tokens, depth + 1, value);
+        if (child == nullptr) return nullptr;
+        copy->members->emplace_back(token, child);
+        return copy;
+    }
+
+    static NodePtr removeAt(const NodePtr &node, const std::vector<std::string> &tokens, size_t depth) {
+        auto &token = tokens[depth];
+        bool last = depth + 1 == tokens.size();
+
+        if (node->kind == Kind::Object) {
+            for (size_t i = 0; i < node->members->size(); ++i) {
+                if ((*node->members)[i].first != token) continue;
+
+                auto copy = std::make_shared<Node>(*node);
+                if (last) {
+                    copy->members->erase(copy->members->begin() + static_cast<std::ptrdiff_t>(i));
+                } else {
+                    auto child = removeAt((*node->members)[i].second, tokens, depth + 1);
+                    if (child == (*node->members)[i].second) return node;
+                    (*copy->members)[i].second = child;
+                }
+                return copy;
+            }
+        } else if (node->kind == Kind::Array) {
+            unsigned int index = 0;
+            if (parseIndex(token, index) && index < node->items->size()) {
+                auto copy = std::make_shared<Node>(*node);
+                if (last) {
+                    copy->items->erase(copy->items->begin() + index);
+                } else {
+                    auto child = removeAt((*node->items)[index], tokens, depth + 1);
+                    if (child == (*node->items)[index]) return node;
+                    (*copy->items)[index] = child;
+                }
+                return copy;
+            }
+        }
+
+        //路径不存在，原样共享
+        return node;
+    }
+
+    static bool equal(const NodePtr &a, const NodePtr &b) {
+        //共享的子树无需比较
+        if (a == b) return true;
+        if (a == nullptr || b == nullptr) return false;
+
+        bool aNumber = a->kind == Kind::Int64 || a->kind == Kind::Uint64 || a->kind == Kind::Double;
+        bool bNumber = b->kind == Kind::Int64 || b->kind == Kind::Uint64 || b->kind == Kind::Double;
+        if (aNumber && bNumber) {
+            if (a->kind == Kind::Double || b->kind == Kind::Double)
+                return RSnapshot(a).toDouble() == RSnapshot(b).toDouble();
+            if (a->kind != b->kind) {
+                //Int64与Uint64只有非负时才可能相等
+                const Node &s = a->kind == Kind::Int64 ? *a : *b;
+                const Node &u = a->kind == Kind::Int64 ? *b : *a;
+                return s.i >= 0 && static_cast<uint64_t>(s.i) == u.u;
+            }
+            return a->kind == Kind::Int64 ? a->i == b->i : a->u == b->u;
+        }
+        if (a->kind != b->kind) return false;
+
+        switch (a->kind) {
+        case Kind::Null: return true;
+        case Kind::Bool: return a->b == b->b;
+        case Kind::String: return *a->str == *b->str;
+        case Kind::Array:
+            if (a->items->size() != b->items->size()) return false;
+            for (size_t i = 0; i < a->items->size(); ++i) {
+                if (!equal((*a->items)[i], (*b->items)[i])) return false;
+            }
+            return true;
+        case Kind::Object:
+            //与rapidjson一致，对象比较不依赖成员顺序
+            if (a->members->size() != b->members->size()) return false;
+            for (auto &member : *a->members) {
+                if (!equal(member.second, RSnapshot(b).find(member.first)._node)) return false;
+            }
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    template<typename Handler>
+    static bool acceptNode(const Node &node, Handler &handler) {
+        switch (node.kind) {
+        case Kind::Null: return handler.Null();
+        case Kind::Bool: return handler.Bool(node.b);
+        case Kind::Int64: return handler.Int64(node.i);
+        case Kind::Uint64: return handler.Uint64(node.u);
+        case Kind::Double: return handler.Double(node.d);
+        case Kind::String:
+            return handler.String(node.str->c_str(), static_cast<rapidjson::SizeType>(node.str->size()), true);
+        case Kind::Array:
+            if (!handler.StartArray()) return false;
+            for (auto &item : *node.items) {
+                if (!acceptNode(*item, handler)) return false;
+            }
+            return handler.EndArray(static_cast<rapidjson::SizeType>(node.items->size()));
+        case Kind::Object:
+            if (!handler.StartObject()) return false;
+            for (auto &member : *node.members) {
+                if (!handler.Key(member.first.c_str(), static_cast<rapidjson::SizeType>(member.first.size()), true))
+                    return false;
+                if (!acceptNode(*member.second, handler)) return false;
+            }
+            return handler.EndObject(static_cast<rapidjson::SizeType>(node.members->size()));
+        }
+        return false;
+    }
+
+    /// SAX Handler，把rapidjson事件构造成快照节点
+    struct Builder {
+        std::shared_ptr<Node> root;
+        std::vector<std::shared_ptr<Node>> stack;
+        std::vector<std::string> keys;
+
+        bool add(const std::shared_ptr<Node> &node) {
+            if (stack.empty()) {
+                root = node;
+            } else if (stack.back()->kind == Kind::Object) {
+                stack.back()->members->emplace_back(std::move(keys.back()), node);
+                keys.pop_back();
+            } else {
+                stack.back()->items->push_back(node);
+            }
+            if (node->kind == Kind::Object || node->kind == Kind::Array)
+                stack.push_back(node);
+            return true;
+        }
+
+        bool Null() { return add(makeNode(Kind::Null)); }
+        bool Bool(bool b) { return add(makeBool(b)); }
+        bool Int(int i) { return add(makeInt64(i)); }
+        bool Uint(unsigned u) { return add(makeUint64(u)); }
+        bool Int64(int64_t i) { return add(makeInt64(i)); }
+        bool Uint64(uint64_t u) { return add(makeUint64(u)); }
+        bool Double(double d) { return add(makeDouble(d)); }
+        bool RawNumber(const char *str, rapidjson::SizeType length, bool) {
+            rapidjson::Value number;
+            if (!detail::decodeNumber(str, length, number)) return false;
+            if (number.IsInt64()) return add(makeInt64(number.GetInt64()));
+            if (number.IsUint64()) return add(makeUint64(number.GetUint64()));
+            return add(makeDouble(number.GetDouble()));
+        }
+        bool String(const char *str, rapidjson::SizeType length, bool) { return add(makeString(str, length)); }
+        bool StartObject() { return add(makeNode(Kind::Object)); }
+        bool Key(const char *str, rapidjson::SizeType length, bool) {
+            keys.emplace_back(str, length);
+            return true;
+        }
+        bool EndObject(rapidjson::SizeType) {
+            stack.pop_back();
+            return true;
+        }
+        bool StartArray() { return add(makeNode(Kind::Array)); }
+        bool EndArray(rapidjson::SizeType) {
+            stack.pop_back();
+            return true;
+        }
+    };
+
+private:
+    NodePtr _node;
+};
+
+/**
+ * @brief RAtomicSnapshot类以类似RCU的方式发布快照。
+ * 写者构造新快照后调用publish()/update()原子替换当前版本；读者调用acquire()获得某一完整版本，
+ * 持有期间该版本不会被释放，也不会看到写者的中间状态。
+ * 每个读线程缓存最近获取的版本，版本号未变化时acquire()只读取一个原子计数，不加锁；
+ * 版本变化后的第一次acquire()通过std::atomic_load读取新版本，部分标准库(如libstdc++)以全局锁池实现，会短暂加锁。
+ * 旧版本在最后一个持有者释放后回收，读线程缓存的旧版本在该线程下一次acquire()或线程退出时释放。
+ * 多个写者通过update()的比较交换重试保证不丢失修改。
+ * @code 典型用法
+ *      RAtomicSnapshot config(RSnapshot::fromJson(txt.c_str(), txt.size()));
+ *      //写线程
+ *      config.update([](const RSnapshot &current) { return current.set("/timeout", 30); });
+ *      //读线程
+ *      auto snapshot = config.acquire();
+ *      int timeout = snapshot.get("/timeout").toInt();
+ */
+class RAtomicSnapshot {
+public:
+    RAtomicSnapshot() {}
+    /// snapshot无效时与默认构造相同，acquire()返回无效快照
+    explicit RAtomicSnapshot(const RSnapshot &snapshot) {
+        if (snapshot.isValid())
+            _current = std::make_shared<RSnapshot>(snapshot);
+        else
+            printf("RAtomicSnapshot error, invalid snapshot is not published.\n");
+    }
+    RAtomicSnapshot(const RAtomicSnapshot &) = delete;
+    RAtomicSnapshot& operator=(const RAtomicSnapshot &) = delete;
+
+    /// 获取当前版本
+    RSnapshot acquire() const {
+        auto &cache = readerCache();
+        auto &entry = cache[this];
+        uint64_t version = _version.load(std::memory_order_acquire);
+        //owner未失效说明缓存属于当前对象，而不是同一地址上已析构的对象
+        if (entry.version == version && !entry.owner.expired())
+            return entry.snapshot;
+
+        auto current = std::atomic_load(&_current);
+        entry.owner = _token;
+        entry.version = version;
+        entry.snapshot = current != nullptr ? *current : RSnapshot();
+        RSnapshot result = entry.snapshot;
+        //顺便清理已析构对象的缓存
+        for (auto iter = cache.begin(); iter != cache.end();) {
+            if (iter->second.owner.expired()) iter = cache.erase(iter);
+            else ++iter;
+        }
+        return result;
+    }
+
+    /// 发布新版本，替换当前版本；snapshot无效时不发布，返回false
+    bool publish(const RSnapshot &snapshot) {
+        if (!snapshot.isValid()) {
+            printf("RAtomicSnapshot publish error, invalid snapshot is not published.\n");
+            return false;
+        }
+        std::atomic_store(&_current, std::shared_ptr<const RSnapshot>(std::make_shared<RSnapshot>(snapshot)));
+        _version.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief update基于当前版本计算新版本并发布，其他写者抢先发布时用最新版本重新计算。
+     * @param f 形如RSnapshot(const RSnapshot&)的函数，可能被调用多次，不能有副作用
+     * @return 发布成功的新版本；f返回无效快照(例如set()下标越界)时不发布，返回无效快照
+     */
+    template<typename Function>
+    RSnapshot update(Function f) {
+        auto expected = std::atomic_load(&_current);
+        while (true) {
+            auto next = std::make_shared<RSnapshot>(f(expected != nullptr ? *expected : RSnapshot()));
+            if (!next->isValid()) {
+                printf("RAtomicSnapshot update error, invalid snapshot is not published.\n");
+                return {};
+            }
+            std::shared_ptr<const RSnapshot> desired = next;
+            if (std::atomic_compare_exchange_strong(&_current, &expected, desired)) {
+                _version.fetch_add(1, std::memory_order_release);
+                return *next;
+            }
+        }
+    }
+
+private:
+    struct CacheEntry {
+        std::weak_ptr<const char> owner;
+        uint64_t version = 0;
+        RSnapshot snapshot;
+    };
+
+    static std::unordered_map<const RAtomicSnapshot*, CacheEntry>& readerCache() {
+        static thread_local std::unordered_map<const RAtomicSnapshot*, CacheEntry> cache;
+        return cache;
+    }
+
+private:
+    std::shared_ptr<const RSnapshot> _current;
+    /// 每次发布加1，读者据此判断缓存是否过期
+    std::atomic<uint64_t> _version{1};
+    /// 标识对象生命周期，读线程缓存据此识别已析构的对象
+    std::shared_ptr<const char> _token = std::make_shared<const char>('\0');
+};
+}
+
+#endif// __RSnapshot_H__
@@ -1,7 +1,15 @@
 ﻿
 #include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <unordered_set>
 
 #include "RJson.h"
+#include "RPipeline.h"
+#include "RPushParser.h"
+#include "RSchema.h"
+#include "RSnapshot.h"
 
 using namespace RJson;
 using namespace rapidjson;
@@ -119,6 +127,20 @@ void testRJson() {
         printf("%s\n", doc1.toJson().c_str());
     }
 
+    {
+        // 延迟解码数字，并允许注释和末尾逗号
+        // 运行输出结果：
+        // {"id":12345678901234567890123,"amp":1.50,"count":2}
+        // 2 1.500000
+        printf("\nparse JSON string with flags: \n");
+        std::string str = "{\"id\":12345678901234567890123,/*comment*/\"amp\":1.50,\"count\":2,}";
+        auto doc1 = RDocument::fromJson<kParseLazyNumbers | kParseComments | kParseTrailingCommas>(str.c_str(), str.size());
+        if (doc1.hasParseError())
+            printf("parse error:%s, offset:%u\n", doc1.parseErrorString().c_str(), (unsigned int)doc1.errorOffset());
+        printf("%s\n", doc1.toJson().c_str());
+        printf("%d %f\n", doc1["count"].toInt(), doc1["amp"].toDouble());
+    }
+
     {
         //重新构造JSON，并转成字符串
         printf("\ncreate JSON, to string: \n");
@@ -224,6 +246,128 @@ void testRJson() {
         print(value);
     }
 
+    {
+        //按列读取对象数组，再按列构造新的对象数组
+        // 运行输出结果：
+        // amp:12.500000,size:2,name:b
+        // [{"size":1,"amp":10.5},{"size":2,"amp":12.5}]
+        printf("\ncolumns:\n");
+        std::string txt = "{\"values\":[{\"name\":\"a\",\"size\":1,\"amp\":10.5},{\"name\":\"b\",\"size\":2,\"amp\":12.5}]}";
+        auto doc = RDocument::fromJson(txt.c_str(), txt.size());
+        std::vector<double> amp;
+        std::vector<int64_t> size;
+        std::vector<RStringView> name;
+        RColumns columns;
+        columns.add("amp", &amp).add("size", &size).add("name", &name);
+        doc.find("values").extractColumns(columns);
+        printf("amp:%f,size:%d,name:%s\n", amp[1], (int)size[1], name[1].toString().c_str());
+
+        RColumns numbers;
+        numbers.add("size", &size).add("amp", &amp);
+        RDocument out;
+        out.appendColumns(numbers);
+        print(out);
+    }
+
+    {
+        //快照：修改只复制路径上的节点，未修改的子树新旧版本共享
+        // 运行输出结果：
+        // {"servers":[{"host":"a","port":80}],"timeout":10}
+        // {"servers":[{"host":"a","port":8080}],"timeout":10}
+        printf("\nsnapshot:\n");
+        std::string txt = "{\"servers\":[{\"host\":\"a\",\"port\":80}],\"timeout\":10}";
+        RAtomicSnapshot config(RSnapshot::fromJson(txt.c_str(), txt.size()));
+        auto v1 = config.acquire();
+        auto v2 = config.update([](const RSnapshot &current) { return current.set("/servers/0/port", 8080); });
+        printf("%s\n%s\n", v1.toJson().c_str(), v2.toJson().c_str());
+    }
+
+    {
+        //增量解析：数据按任意长度分块推入，块边界可以落在字符串或数字中间
+        // 运行输出结果：
+        // {"name":"smith","scores":[98.5,87,100]}
+        // Missing a colon after a name of object member., offset:16
+        printf("\npush parser:\n");
+        std::string txt = "{\"name\":\"smith\",\"scores\":[98.5,87,100]}";
+        RPushParser parser;
+        for (size_t i = 0; i < txt.size(); i += 5)
+            parser.feed(txt.data() + i, std::min<size_t>(5, txt.size() - i));
+        if (parser.finish())
+            print(parser.document());
+        else
+            printf("%s, offset:%u\n", parser.document().parseErrorString().c_str(), (unsigned int)parser.errorOffset());
+
+        //出错位置与一次性解析相同，这里是第三个key后面的'x'
+        parser.reset();
+        std::string bad = "{\"a\":1,\"b\":2,\"c\"x}";
+        for (size_t i = 0; i < bad.size(); i += 3)
+            parser.feed(bad.data() + i, std::min<size_t>(3, bad.size() - i));
+        if (!parser.finish())
+            printf("%s, offset:%u\n", parser.document().parseErrorString().c_str(), (unsigned int)parser.errorOffset());
+    }
+
+    {
+        //解析时校验schema，遇到第一个不满足的值即中止
+        // 运行输出结果：
+        // minimum /age offset:22
+        printf("\nschema:\n");
+        RSchemaCache schemas;
+        std::string schemaText = "{\"type\":\"object\",\"properties\":{\"age\":{\"type\":\"integer\",\"minimum\":0}},\"required\":[\"name\"]}";
+        auto person = schemas.add("person", schemaText.c_str(), schemaText.size());
+        std::string txt = "{\"name\":\"smith\",\"age\":-1}";
+        RSchemaViolation violation;
+        RDocument doc;
+        if (!person->parse(doc, txt.c_str(), txt.size(), &violation))
+            printf("%s %s offset:%u\n", violation.keyword.c_str(), violation.documentPointer.c_str(), (unsigned int)violation.offset);
+    }
+
+    {
+        //反复覆盖后整理内存，内存占用回到与存活数据成正比
+        printf("\ncompact:\n");
+        RDocument state;
+        for (int i = 0; i < 10000; ++i)
+            state["status"] = "connection " + std::to_string(i) + " established, waiting for next heartbeat";
+        size_t before = state.memoryUsage();
+        size_t reclaimed = state.compact(0.5);
+        printf("before:%u, reclaimed:%u, after:%u\n", (unsigned int)before, (unsigned int)reclaimed, (unsigned int)state.memoryUsage());
+    }
+
+    {
+        //紧凑数组：同类数字连续保存，span()直接访问，序列化时展开为普通数组
+        // 运行输出结果：
+        // packed:3, sum:15.5
+        // {"samples":[1.5,2.0,3.0,4.0,5.0],"ids":[1,2,3,4,5]}
+        printf("\npacked array:\n");
+        std::string txt = "{\"samples\":[1.5,2.0,3.0,4.0],\"ids\":[1,2,3,4,5]}";
+        auto doc = RDocument::fromJson<kParsePackArrays>(txt.c_str(), txt.size());
+        double more[] = {5.0};
+        doc["samples"].append(more, 1);
+        double sum = 0;
+        for (double sample : doc.find("samples").span<double>())
+            sum += sample;
+        printf("packed:%d, sum:%g\n", doc.find("samples").packedType(), sum);
+        print(doc);
+    }
+
+    {
+        //结构哈希：对象与成员顺序无关，可用于去重和变更检测
+        // 运行输出结果：
+        // duplicate:2
+        // changed:1
+        printf("\nstructural hash:\n");
+        std::string txt = "[{\"id\":1,\"tags\":[\"a\",\"b\"]},{\"id\":2},{\"tags\":[\"a\",\"b\"],\"id\":1.0}]";
+        auto doc = RDocument::fromJson(txt.c_str(), txt.size());
+        std::unordered_set<RConstValue, RHash> seen;
+        for (unsigned int i = 0; i < doc.root().size(); ++i)
+            if (!seen.insert(doc.at(i)).second) printf("duplicate:%u\n", i);
+
+        RDocument previous(doc);
+        doc.setHashCaching(true);
+        previous.setHashCaching(true);
+        doc[1]["id"] = 3;
+        printf("changed:%d\n", doc != previous);
+    }
+
     {
         RDocument result;
         RValue payload(result.allocator());
@@ -267,8 +411,88 @@ void testRJson() {
     }
 }
 
+void demoPipeline() {
+    //流水线：读取、解析、转换、写入四个阶段并行，逐条处理顶层数组，输出NDJSON
+    // 运行输出结果：
+    // {"id":1,"name":"a","checked":true}
+    // {"id":3,"name":"c","checked":true}
+    // (各阶段吞吐和队列深度)
+    printf("\npipeline:\n");
+    std::string txt = "[{\"id\":1,\"name\":\"a\"},{\"name\":\"b\"},{\"id\":3,\"name\":\"c\"}]";
+    FILE *file = fopen("pipeline_in.json", "wb");
+    if (file == nullptr) {
+        printf("can not create pipeline_in.json\n");
+        return;
+    }
+    fwrite(txt.data(), 1, txt.size(), file);
+    fclose(file);
+
+    RPipeline pipeline;
+    pipeline.setInputFormat(kRecordArray).setOutputFormat(kRecordLines).setBatchSize(2);
+    pipeline.run("pipeline_in.json", "pipeline_out.json", [](RDocument &doc) {
+        doc["checked"] = true;
+        return doc.contains("id");
+    });
+
+    char line[256];
+    file = fopen("pipeline_out.json", "rb");
+    while (file != nullptr && fgets(line, sizeof(line), file) != nullptr)
+        printf("%s", line);
+    if (file != nullptr) fclose(file);
+    printf("%s", pipeline.stats().toString().c_str());
+    remove("pipeline_in.json");
+    remove("pipeline_out.json");
+}
+
+void benchConcurrentRead() {
+    //多线程只读查询同一个RFrozenDocument，观察吞吐随线程数的变化
+    printf("\n***************concurrent read***************\n");
+    const unsigned int count = 100000;
+    RDocument doc;
+    RValue values(doc.allocator());
+    for (unsigned int i = 0; i < count; ++i) {
+        RValue field(doc.allocator());
+        field["name"] = "123123asdfasdfsdafsdaf";
+        field["size"] = 222;
+        field["offset"] = 123;
+        field["amp"] = 12.2321;
+        field["signal_id"] = "123";
+        values.append(field);
+    }
+    doc["values"] = values;
+    auto frozen = std::make_shared<RFrozenDocument>(std::move(doc));
+
+    const int rounds = 20;
+    unsigned int cores = std::thread::hardware_concurrency();
+    if (cores == 0) cores = 1;
+    for (unsigned int threads = 1; threads <= cores; threads *= 2) {
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; ++t) {
+            workers.emplace_back([frozen]() {
+                double sum = 0;
+                auto array = frozen->find("values");
+                for (int r = 0; r < rounds; ++r) {
+                    for (unsigned int i = 0; i < array.size(); ++i) {
+                        sum += array.at(i).find("amp").toDouble();
+                    }
+                }
+                if (sum < 0) printf("%f\n", sum);
+            });
+        }
+        for (auto &worker : workers) worker.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        double lookups = static_cast<double>(threads) * rounds * count;
+        printf("threads:%u, lookups:%.0f, %.2fM lookups/s\n", threads, lookups, lookups / seconds / 1e6);
+    }
+}
+
 int main(int, char *[])
 {
+    benchConcurrentRead();
+    //读写文件，只运行一次
+    demoPipeline();
+
     while (true) {
     testRJson();
     }